@@ -7,6 +7,7 @@
 
 #include "include/CallString.h"
 #include "include/LivenessPointsTo.h"
+#include "include/LivenessPointsToPass.h"
 #include "include/PointsToData.h"
 
 using namespace llvm;
@@ -15,20 +16,25 @@ namespace {
 struct TestPass : public ModulePass {
     static char ID;
 
-    LivenessPointsTo analysis;
-
     TestPass() : ModulePass(ID) {}
 
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+        AU.addRequired<LivenessPointsToPass>();
+        AU.setPreservesAll();
+    }
+
     bool runOnModule(Module &M) override {
-        analysis.runOnModule(M);
+        LivenessPointsTo &analysis = getAnalysis<LivenessPointsToPass>().getResult();
         errs() << "\n";
         errs() << "Worklist iterations: " << analysis.worklistIterations << "\n";
         errs() << "Times ran on function: " << analysis.timesRanOnFunction << "\n";
+        errs() << "Contexts merged by the call string limit: " << analysis.mergedContexts << "\n";
 
         for (Function &F : M) {
-            if (F.isDeclaration())
+            if (F.isDeclaration() || !analysis.hasPointsTo(F))
                 continue;
-            ProcedurePointsTo data = *analysis.getPointsTo(F);
+            analysis.materialize(F);
+            const ProcedurePointsTo &data = *analysis.getPointsTo(F);
             errs() << "Number of call strings for " << F.getName() << ": " << data.size() << "\n";
             for (auto &P : data) {
                 errs() << "\n";
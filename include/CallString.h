@@ -1,19 +1,61 @@
 #ifndef LFCPA_CALLSTRING_H
 #define LFCPA_CALLSTRING_H
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 
 using namespace llvm;
 
+// Call strings are handles to nodes of a global trie of call sites. Each node
+// represents the sequence of call sites on the path from the root to it, and
+// is created only once, so two sequences are equal exactly when their nodes
+// are. A cyclic call string S . S'* is represented by the nodes for S and S'.
+// The trie may be used by several threads at once.
 class CallString {
     public:
+        // The parts of a non-cyclic call string that determine which nodes
+        // are summary nodes in the functions called from it: whether it is
+        // empty, the function called by its last call (if it has one), and
+        // the number of calls in each function, capped at 2 and ordered by
+        // function.
+        typedef std::tuple<bool, bool, const Function *, std::vector<std::pair<const Function *, unsigned>>> Profile;
+
         static CallString empty();
+        // Destroys the trie. No call strings may be in use when it is called.
+        static void clear();
+        // Stops the trie from extending call strings with the given calls,
+        // which may have been freed, so that calls created at the same
+        // addresses get new nodes. Existing call strings are unaffected.
+        static void forgetCallSites(const SmallPtrSetImpl<const Instruction *> &);
         CallString addCallSite(const Instruction *) const;
+        // Returns the call string that stands for every extension of this
+        // one, when call strings are limited in length. It is represented by
+        // a node without a call, and extending it gives the same string.
+        CallString getSummary() const;
         bool isNonCyclicPrefix(const CallString &) const;
         CallString createCyclicFromPrefix(const CallString &) const;
         bool matches(const CallString &) const;
+        Profile getProfile() const;
+        // Returns the calls in the non-cyclic or the cyclic part of the call
+        // string, in order. A summary has no call of its own, so it gives the
+        // calls of the string that it extends.
+        SmallVector<const Instruction *, 8> getCallSites(bool Cyclic) const;
+        // Returns true if any of the calls is in the call string. The calls
+        // are only compared by address.
+        bool containsCallSiteIn(const SmallPtrSetImpl<const Instruction *> &) const;
+        // Returns true if the key of the call string or of one of its
+        // non-cyclic prefixes is in Keys.
+        bool hasNonCyclicPrefixIn(const DenseSet<std::pair<unsigned, unsigned>> &Keys) const;
         CallString(const CallString &other) : nonCyclic(other.nonCyclic), cyclic(other.cyclic) {}
         void dump() const;
 
@@ -21,22 +63,33 @@ class CallString {
             return C.cyclic == cyclic && C.nonCyclic == nonCyclic;
         }
 
+        inline bool operator!=(const CallString &C) const {
+            return !operator==(C);
+        }
+
         inline bool isEmpty() const {
-            return cyclic.empty() && nonCyclic.empty();
+            return cyclic->isRoot() && nonCyclic->isRoot();
         }
 
         inline bool isCyclic() const {
-            return !cyclic.empty();
+            return !cyclic->isRoot();
+        }
+
+        inline bool isSummary() const {
+            return !nonCyclic->isRoot() && nonCyclic->Call == nullptr;
         }
 
         inline int size() const {
-            return nonCyclic.size();
+            return nonCyclic->depth;
+        }
+
+        // Returns a pair of IDs that uniquely identifies the call string.
+        inline std::pair<unsigned, unsigned> getKey() const {
+            return std::make_pair(nonCyclic->id, cyclic->id);
         }
 
         inline const Instruction *getLastCall() const {
-            if (nonCyclic.empty())
-                return nullptr;
-            return nonCyclic.back();
+            return nonCyclic->Call;
         }
 
 
@@ -50,33 +103,16 @@ class CallString {
         }
 
         inline bool containsCallIn(const Function *F) const {
-            for (const Instruction *I : nonCyclic)
-                if (const CallInst *CI = dyn_cast<CallInst>(I))
-                    if (CI->getParent()->getParent() == F)
-                        return true;
-            for (const Instruction *I : cyclic)
-                if (const CallInst *CI = dyn_cast<CallInst>(I))
-                    if (CI->getParent()->getParent() == F)
-                        return true;
-            return false;
+            return nonCyclic->countCallsIn(F) > 0 || cyclic->countCallsIn(F) > 0;
         }
 
         inline bool reachedMoreThanOnce(const Function *F) const {
-            bool foundCall = false;
-            const CallInst *Last = nullptr;
-            for (const Instruction *I : nonCyclic) {
-                if (const CallInst *CI = dyn_cast<CallInst>(I)) {
-                    if (CI->getParent()->getParent() == F) {
-                        if (foundCall)
-                            return true;
-                        else
-                            foundCall = true;
-                    }
-                    Last = CI;
-                }
-            }
+            unsigned calls = nonCyclic->countCallsIn(F);
+            if (calls > 1)
+                return true;
 
-            if (foundCall && Last != nullptr) {
+            const CallInst *Last = nonCyclic->LastCallInst;
+            if (calls == 1 && Last != nullptr) {
                 // This is imprecise because Last may not actually be a call to
                 // F if getCalledFunction is nullptr, but it is safe.
                 return Last->getCalledFunction() == nullptr || Last->getCalledFunction() == F;
@@ -85,9 +121,58 @@ class CallString {
             return false;
         }
     private:
-        SmallVector<const Instruction *, 8> nonCyclic;
-        SmallVector<const Instruction *, 8> cyclic;
-        CallString () {}
+        class Node {
+            public:
+                Node(const Instruction *Call, const Node *Parent);
+
+                inline bool isRoot() const {
+                    return Parent == nullptr;
+                }
+
+                // Returns the ancestor of this node (or the node itself) at
+                // the given depth.
+                const Node *getAncestor(unsigned Depth) const;
+                // Returns the number of calls in F on the path to this node,
+                // capped at 2. The calls below a summary node are unknown, so
+                // it counts as 2 calls in every function.
+                inline unsigned countCallsIn(const Function *F) const {
+                    if (belowSummary)
+                        return 2;
+                    auto I = std::lower_bound(callsIn.begin(), callsIn.end(), std::make_pair(F, 0u));
+                    return I != callsIn.end() && I->first == F ? I->second : 0;
+                }
+                void dumpPath(bool &first) const;
+
+                const Instruction *const Call;
+                const Node *const Parent;
+                const unsigned depth, id;
+                // The nearest CallInst on the path to this node.
+                const CallInst *const LastCallInst;
+                // Jump pointers in the skew-binary scheme, so that ancestors
+                // can be found in a logarithmic number of steps.
+                const Node *jump;
+                mutable DenseMap<const Instruction *, Node *> children;
+                // The number of calls in each function on the path, capped at
+                // 2 and ordered by function, and whether the path has a
+                // summary node. They are computed when the node is created,
+                // so they can be read without the lock.
+                SmallVector<std::pair<const Function *, unsigned>, 4> callsIn;
+                bool belowSummary;
+            private:
+                static const CallInst *findLastCallInst(const Instruction *, const Node *);
+                static const Node *findJump(const Node *);
+        };
+
+        static std::vector<std::unique_ptr<Node>> &getNodes();
+        // The root, once it has been created, so that the empty call string
+        // can be made without the lock.
+        static std::atomic<const Node *> root;
+        static const Node *getRoot();
+        static const Node *getChild(const Node *, const Instruction *);
+
+        const Node *nonCyclic;
+        const Node *cyclic;
+        CallString(const Node *nonCyclic, const Node *cyclic) : nonCyclic(nonCyclic), cyclic(cyclic) {}
 };
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef LFCPA_FUNCTIONFINGERPRINT_H
+#define LFCPA_FUNCTIONFINGERPRINT_H
+
+#include <vector>
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+
+using namespace llvm;
+
+// A summary of a function's IR, used to find the functions that have changed
+// since a module was last analysed. The results refer to instructions by
+// address, so the addresses are part of the hash: a function whose
+// instructions have been recreated has changed even if they are identical.
+// The pointers are recorded so that anything referring to them can be
+// forgotten once they may have been freed.
+struct FunctionFingerprint {
+    hash_code Hash;
+    // The functions that are called directly, ordered by address.
+    SmallVector<const Function *, 8> Callees;
+    // True if the function contains a call whose callee isn't known.
+    bool HasIndirectCalls;
+    // The calls in the function, which may appear in call strings.
+    SmallVector<const Instruction *, 8> CallSites;
+    // The arguments and instructions, which may have nodes.
+    std::vector<const Value *> Values;
+};
+
+FunctionFingerprint computeFingerprint(const Function &F);
+
+#endif
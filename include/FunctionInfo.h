@@ -0,0 +1,34 @@
+#ifndef LFCPA_FUNCTIONINFO_H
+#define LFCPA_FUNCTIONINFO_H
+
+#include <set>
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+
+#include "PointsToNode.h"
+#include "PointsToNodeFactory.h"
+
+using namespace llvm;
+
+// The parts of a function that the solver looks for repeatedly, found once
+// when the function is first analysed. Instructions are in the order in
+// which they appear in the function.
+struct FunctionInfo {
+    FunctionInfo(const Function *F, PointsToNodeFactory &Factory);
+
+    const Instruction *First;
+    // The blocks in reverse post-order, followed by any blocks that are
+    // unreachable from the entry block.
+    SmallVector<const BasicBlock *, 32> Blocks;
+    SmallPtrSet<const PointsToNode *, 8> Arguments;
+    SmallVector<const CallInst *, 8> Calls;
+    SmallVector<const StoreInst *, 8> Stores;
+    SmallVector<const ReturnInst *, 2> Returns;
+    // The nodes of the values that are returned.
+    std::set<PointsToNode *> ReturnValues;
+};
+
+#endif
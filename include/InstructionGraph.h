@@ -0,0 +1,46 @@
+#ifndef LFCPA_INSTRUCTIONGRAPH_H
+#define LFCPA_INSTRUCTIONGRAPH_H
+
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+
+using namespace llvm;
+
+// The instructions of a function that are visited by the solver. Instructions
+// that can't change liveness or points-to information are skipped, so the
+// neighbours of an instruction are the nearest instructions in its block that
+// aren't skipped. The first instruction and the terminator of each block are
+// never skipped, so the edges between blocks are unchanged.
+class InstructionGraph {
+    public:
+        InstructionGraph(const Function *F);
+
+        inline bool contains(const Instruction *I) const {
+            return positions.count(I);
+        }
+
+        // Returns the instructions that aren't skipped, with the blocks in
+        // reverse post-order.
+        inline ArrayRef<const Instruction *> getOrder() const {
+            return order;
+        }
+
+        // Returns the instructions of BB that aren't skipped.
+        ArrayRef<const Instruction *> getInstructions(const BasicBlock *BB) const;
+        // Returns the instruction after I. I must not be a terminator.
+        const Instruction *getNext(const Instruction *I) const;
+        // Returns the instruction before I. I must not be the first
+        // instruction of its block.
+        const Instruction *getPrevious(const Instruction *I) const;
+    private:
+        // The instructions of each block are contiguous.
+        std::vector<const Instruction *> order;
+        DenseMap<const Instruction *, unsigned> positions;
+        DenseMap<const BasicBlock *, std::pair<unsigned, unsigned>> blocks;
+};
+
+#endif
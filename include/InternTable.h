@@ -0,0 +1,83 @@
+#ifndef LFCPA_INTERNTABLE_H
+#define LFCPA_INTERNTABLE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace llvm;
+
+// Stores a single copy of each distinct value of type T that it is given.
+// Interned values are immutable and live until they are swept or the table is
+// destroyed, so two interned values are equal exactly when their pointers
+// are. T must provide operator== and a hash() method.
+template <typename T>
+class InternTable {
+    public:
+        InternTable() {
+            empty = intern(T());
+        }
+        ~InternTable() {
+            for (auto &B : buckets)
+                for (const T *V : B.second)
+                    delete V;
+        }
+        InternTable(const InternTable &) = delete;
+        InternTable &operator=(const InternTable &) = delete;
+
+        const T *intern(const T &V) {
+            // DenseMap reserves the largest unsigned values as special keys,
+            // so the top bit of the hash is dropped.
+            unsigned Hash = V.hash() & 0x7fffffff;
+            SmallVector<const T *, 1> &Bucket = buckets[Hash];
+            for (const T *Existing : Bucket)
+                if (*Existing == V)
+                    return Existing;
+
+            const T *Interned = new T(V);
+            Bucket.push_back(Interned);
+            count++;
+            return Interned;
+        }
+
+        // Frees the values that aren't in Live, apart from the empty value.
+        // Nothing may refer to the freed values afterwards.
+        void sweep(const DenseSet<const T *> &Live) {
+            for (auto I = buckets.begin(), E = buckets.end(); I != E;) {
+                auto Current = I++;
+                SmallVector<const T *, 1> &Bucket = Current->second;
+                for (unsigned i = 0; i < Bucket.size();) {
+                    if (Bucket[i] == empty || Live.count(Bucket[i])) {
+                        i++;
+                        continue;
+                    }
+                    delete Bucket[i];
+                    Bucket[i] = Bucket.back();
+                    Bucket.pop_back();
+                    count--;
+                }
+                if (Bucket.empty())
+                    buckets.erase(Current);
+            }
+            swept = count;
+        }
+
+        inline const T *getEmpty() const {
+            return empty;
+        }
+
+        inline unsigned size() const {
+            return count;
+        }
+
+        // The number of values that were kept by the last sweep.
+        inline unsigned sizeAfterSweep() const {
+            return swept;
+        }
+    private:
+        DenseMap<unsigned, SmallVector<const T *, 1>> buckets;
+        unsigned count = 0, swept = 0;
+        const T *empty;
+};
+
+#endif
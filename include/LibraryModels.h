@@ -0,0 +1,51 @@
+#ifndef LFCPA_LIBRARYMODELS_H
+#define LFCPA_LIBRARYMODELS_H
+
+#include <string>
+#include <utility>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+// What a call to a declared function does to pointers. A call with an empty
+// model doesn't change what anything points to. Arguments are numbered from
+// zero.
+struct LibraryModel {
+    // The return value points to memory that is freshly allocated by the
+    // call.
+    bool Allocates = false;
+    // The return value may point to whatever these arguments point to.
+    SmallVector<unsigned, 1> ReturnedArguments;
+    // The memory pointed to by the first argument of each pair is copied to
+    // the memory pointed to by the second.
+    SmallVector<std::pair<unsigned, unsigned>, 1> Copies;
+
+    // Returns true if every argument used by the model is passed by CI.
+    bool appliesTo(const CallInst *CI) const;
+};
+
+// The models of library functions, indexed by name. The built-in models can
+// be extended or replaced by the spec file given by -lfcpa-library-models.
+class LibraryModels {
+    public:
+        // Returns the models, reading the spec file the first time it is
+        // called.
+        static const LibraryModels &get();
+
+        // Returns the model of F, or nullptr if F must be handled
+        // conservatively.
+        const LibraryModel *lookup(const Function *F) const;
+    private:
+        LibraryModels();
+        // Adds the models in Spec, replacing any existing models of the same
+        // functions. Returns false and sets Error if Spec is malformed.
+        bool parse(StringRef Spec, std::string &Error);
+
+        StringMap<LibraryModel> models;
+};
+
+#endif
@@ -1,52 +1,228 @@
 #ifndef LFCPA_LIVENESSPOINTSTO_H
 #define LFCPA_LIVENESSPOINTSTO_H
 
+#include <atomic>
+#include <map>
+#include <memory>
 #include <set>
+#include <vector>
 
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Function.h"
 
+#include "FunctionFingerprint.h"
+#include "FunctionInfo.h"
+#include "InstructionGraph.h"
+#include "LibraryModels.h"
 #include "PointsToData.h"
 #include "PointsToNode.h"
 #include "PointsToNodeFactory.h"
+#include "Worklist.h"
 
 using namespace llvm;
 
 class LivenessPointsTo {
 public:
-    SmallVector<std::tuple<CallString, const Function *, PointsToRelation, LivenessSet, bool>, 64> callData;
+    // The boundary information last used for each call string and callee.
+    DenseMap<std::pair<std::pair<unsigned, unsigned>, const Function *>, std::tuple<const PointsToRelation *, const LivenessSet *, bool>> callData;
+    LivenessPointsTo();
+    ~LivenessPointsTo();
     void runOnModule(Module &);
+    // Prepares to analyse the module on demand: each root is only analysed
+    // when a value in a function that it reaches is first queried, and its
+    // results are kept for later queries.
+    void prepareOnDemand(Module &);
+    // Analyses the roots that haven't been queried since prepareOnDemand.
+    void finishOnDemand(Module &);
+    // Returns true if the analysis is kept between runs on a module, so that
+    // only what has changed is analysed again.
+    static bool isIncremental();
     ProcedurePointsTo *getPointsTo(Function &) const;
-    std::set<PointsToNode *> getPointsToSet(const Value *, bool &);
-    static unsigned worklistIterations, timesRanOnFunction;
+    // Returns true if the function has been analysed in some context.
+    bool hasPointsTo(const Function &) const;
+    // Sets Result to the nodes that V may point to. An empty result means
+    // that it isn't known.
+    void getPointsToSet(const Value *V, SmallVectorImpl<PointsToNode *> &Result, bool &AllowMustAlias);
+    // Sets Result to the nodes that V may point to when I is reached in the
+    // context CS, which must not be cyclic (a cyclic context that matches it
+    // is used). V must be a global or a value in the function of I; a value
+    // defined by I is looked up just after it. An empty result means that it
+    // isn't known.
+    void getPointsToSetAt(const Value *V, const Instruction *I, const CallString &CS, SmallVectorImpl<PointsToNode *> &Result, bool &AllowMustAlias);
+    // As above, but joins the information from every context in which the
+    // function of I has been analysed.
+    void getPointsToSetAt(const Value *V, const Instruction *I, SmallVectorImpl<PointsToNode *> &Result, bool &AllowMustAlias);
+    // Sets Result to the nodes that the call may read or write: those that
+    // are reachable from its arguments and from the nodes that are live
+    // before it, in any context. Returns false if they aren't known, which
+    // is the case if the call may reach an indirect call or a function
+    // without a body that accesses memory.
+    bool getAccessibleNodes(const CallInst *CI, SmallVectorImpl<PointsToNode *> &Result);
+    // Returns the node of the analysis with the ID.
+    inline PointsToNode *getNodeWithId(unsigned Id) const {
+        return factory.getNodeWithId(Id);
+    }
+    // Returns true if every access to memory made by the function that CI
+    // calls, and by the functions that it calls, is seen by the analysis.
+    // Visibility is filled in for every function of the module, a strongly
+    // connected component of the call graph at a time, when it is empty.
+    static bool hasVisibleAccesses(const CallInst *CI, DenseMap<const Function *, bool> &Visibility);
+    // Computes the information at every instruction of the function, if only
+    // the information at the boundaries of its blocks has been kept.
+    void materialize(const Function &);
+    // Frees the state that is only used while the module is being solved.
+    void releaseScratch();
+    static std::atomic<unsigned> worklistIterations, timesRanOnFunction;
+    // The number of calls whose contexts were merged into a summary because
+    // their call strings would have been longer than the limit, since the
+    // module was last analysed.
+    unsigned mergedContexts;
 private:
-    void insertNewPairs(PointsToRelation &, const Instruction *, PointsToRelation &, LivenessSet &);
-    void subtractKill(const CallString &CS, LivenessSet &, const Instruction *, PointsToRelation &);
-    void unionRef(LivenessSet &, const Instruction *, LivenessSet &, PointsToRelation &);
-    void computeLout(const Instruction *, LivenessSet &, IntraproceduralPointsTo &);
+    static void findVisibleAccesses(Module &, DenseMap<const Function *, bool> &);
+    // The number of analyses that exist; the call string trie is destroyed
+    // with the last one.
+    static unsigned instances;
+    // Creates a worker which analyses some of the roots of a module, sharing
+    // the nodes of the analysis that owns it.
+    explicit LivenessPointsTo(PointsToNodeFactory &);
+    void insertNewPairs(PointsToRelation &, const Instruction *, const PointsToRelation &, const LivenessSet &);
+    void subtractKill(const CallString &CS, LivenessSet &, const Instruction *, const PointsToRelation &);
+    void unionRef(LivenessSet &, const Instruction *, const LivenessSet &, const PointsToRelation &);
+    void computeLout(const Instruction *, const InstructionGraph &, const LivenessSet *&, IntraproceduralPointsTo &);
     bool isArgument(const Function *, const PointsToNode *);
-    bool computeAin(const Instruction *, const Function *, PointsToRelation &, LivenessSet &, IntraproceduralPointsTo *, bool InsertAtFirstInstruction);
-    bool getCalledFunctions(SmallVector<const Function *, 8> &, const CallInst *, PointsToRelation &);
-    void addLinCalledDeclaration(LivenessSet &, const CallString &, const CallInst *, LivenessSet &);
-    void addLinAnalysableCalledFunction(LivenessSet &, const Function *, const CallString &, const CallInst *, LivenessSet &, LivenessSet &);
-    LivenessSet findRelevantNodes(const CallInst *, LivenessSet &);
-    bool computeLin(const CallString &, const Instruction *, PointsToRelation &, LivenessSet &, LivenessSet &);
-    void addAoutCalledDeclaration(PointsToRelation &, const CallInst *, PointsToRelation &, LivenessSet &);
-    void addAoutAnalysableCalledFunction(PointsToRelation &, const Function *, const CallString &, const CallInst *, PointsToRelation &, LivenessSet &);
-    bool computeAout(const CallString &, const Instruction *, PointsToRelation &, PointsToRelation &, LivenessSet &);
-    std::set<PointsToNode *> getKillableDeclaration(const CallInst *, PointsToRelation &);
-    std::pair<LivenessSet, PointsToRelation> getCalledFunctionResult(const CallString &, const Function *);
-    std::set<PointsToNode *> getReturnValues(const Function *);
-    LivenessSet computeFunctionExitLiveness(const CallInst *, LivenessSet *);
-    PointsToRelation replaceActualArgumentsWithFormal(const Function *, const CallInst *, PointsToRelation *);
-    LivenessSet replaceFormalArgumentsWithActual(const CallString &CS, const Function *, const CallInst *, LivenessSet &, LivenessSet &);
-    PointsToRelation replaceReturnValuesWithCallInst(const CallInst *, PointsToRelation &, std::set<PointsToNode *> &, LivenessSet &);
+    const PointsToRelation *restrictRelation(const PointsToRelation *, const LivenessSet *);
+    bool computeAin(const Instruction *, const Function *, const InstructionGraph &, const PointsToRelation *&, const LivenessSet *, IntraproceduralPointsTo *, bool InsertAtFirstInstruction);
+    bool getCalledFunctions(SmallVector<const Function *, 8> &, const CallInst *, const PointsToRelation &);
+    bool findIndirectTargets(SmallVectorImpl<const Function *> &, const CallInst *, const PointsToRelation &);
+    void addLinCalledDeclaration(LivenessSet &, const CallString &, const CallInst *, const LivenessSet &);
+    void addLinModelledDeclaration(LivenessSet &, const CallString &, const CallInst *, const LibraryModel &, const PointsToRelation &, const LivenessSet &);
+    void addLinAnalysableCalledFunction(LivenessSet &, const Function *, const CallString &, const CallInst *, const LivenessSet &, const LivenessSet &);
+    LivenessSet findRelevantNodes(const CallInst *, const LivenessSet &);
+    bool computeLin(const CallString &, const Instruction *, const PointsToRelation &, const LivenessSet *&, const LivenessSet &);
+    void addAoutCalledDeclaration(PointsToRelation &, const CallInst *, const PointsToRelation &, const LivenessSet &);
+    void addAoutModelledDeclaration(PointsToRelation &, const CallInst *, const LibraryModel &, const PointsToRelation &, const LivenessSet &);
+    void addAoutAnalysableCalledFunction(PointsToRelation &, const Function *, const CallString &, const CallInst *, const PointsToRelation &, const LivenessSet &);
+    bool computeAout(const CallString &, const Instruction *, const PointsToRelation &, const PointsToRelation *&, const LivenessSet &);
+    const LibraryModel *getLibraryModel(const CallInst *, const Function *);
+    std::set<PointsToNode *> getKillableDeclaration(const CallInst *, const PointsToRelation &);
+    // Returns the liveness at the entry of F and the join of the points-to
+    // information at its returns, in the context of CS.
+    std::pair<const LivenessSet *, const PointsToRelation *> getCalledFunctionResult(const CallString &CS, const Function *F);
+    const FunctionInfo &getInfo(const Function *);
+    const std::set<PointsToNode *> &getReturnValues(const Function *);
+    LivenessSet computeFunctionExitLiveness(const CallInst *, const LivenessSet *);
+    PointsToRelation replaceActualArgumentsWithFormal(const Function *, const CallInst *, const PointsToRelation *);
+    LivenessSet replaceFormalArgumentsWithActual(const CallString &CS, const Function *, const CallInst *, const LivenessSet &, const LivenessSet &);
+    PointsToRelation replaceReturnValuesWithCallInst(const CallInst *, const PointsToRelation &, const std::set<PointsToNode *> &, const LivenessSet &);
+    void initializeNonResult(const Function *, const Instruction *, const PointsToRelation *, const LivenessSet *, bool, IntraproceduralPointsTo &);
+    const InstructionGraph &getGraph(const Function *);
+    void solve(const Function *, const CallString &, const InstructionGraph &, IntraproceduralPointsTo *, IntraproceduralPointsTo &, Worklist<Instruction> &);
+    void solveBlock(const Function *, const CallString &, const BasicBlock *, const IntraproceduralPointsTo *, const PointsToRelation *, const LivenessSet *, bool, IntraproceduralPointsTo &, IntraproceduralPointsTo &);
+    void addCalls(const CallString &, const CallInst *, const PointsToRelation *, const LivenessSet *, SmallVector<std::tuple<const CallInst *, const Function *, PointsToRelation, LivenessSet, bool>, 8> &);
     void runOnFunction(const Function *, const CallString &, IntraproceduralPointsTo *, PointsToRelation &, LivenessSet &, bool, SmallVector<std::tuple<const CallInst *, const Function *, PointsToRelation, LivenessSet, bool>, 8> &);
+    void runOnFunctionBlocks(const Function *, const CallString &, IntraproceduralPointsTo *, PointsToRelation &, LivenessSet &, bool, SmallVector<std::tuple<const CallInst *, const Function *, PointsToRelation, LivenessSet, bool>, 8> &);
+    // Computes the information at every instruction of a result that only
+    // has it at block boundaries. Returns false if the function's blocks
+    // have changed since, so that it can't be.
+    bool materializeResult(const Function *, IntraproceduralPointsTo *);
+    bool getPointsToSetOfConstant(const Value *, SmallVectorImpl<PointsToNode *> &, bool &);
+    PointsToNode *getQueriedNode(const Value *, const Instruction *, bool &);
+    bool getRelationsAt(const Instruction *, bool, const ProcedurePointsTo::Entry &, SmallVectorImpl<const PointsToRelation *> &);
+    bool addPointeesAt(PointsToNode *, const Instruction *, bool, const ProcedurePointsTo::Entry &, SmallVectorImpl<PointsToNode *> &);
+    CallString extendCallString(const CallString &, const Instruction *);
+    // Look up the nodes in the caches of this analysis before the factory,
+    // which has to be locked.
+    PointsToNode *getNode(const Value *);
+    PointsToNode *getNoAliasNode(const Instruction *);
+    void clearLookupCaches();
+    bool joinSummaryBoundary(const CallString &, const Function *, PointsToRelation &, LivenessSet &, bool &);
     bool runOnFunctionAt(const CallString &, const Function *, PointsToRelation &, LivenessSet &, bool, bool);
+    void runOnRoot(const Function *);
+    // Frees the interned facts that the analysis no longer refers to, if
+    // enough have been interned since they were last freed. Nothing on the
+    // stack may refer to a fact when this is called.
+    void sweepFacts();
+    // Analyses the pending roots that F's results depend on.
+    void analyseReachingRoots(const Function *F);
+    void runOnRootsInParallel(ArrayRef<const Function *>, unsigned);
+    void recordFingerprints(Module &);
+    SmallVector<const Function *, 32> invalidateChangedFunctions(Module &, ArrayRef<const Function *>);
+    void eraseContext(const Function *, const CallString &);
+    void pruneUnvalidatedContexts();
     void addNotInvalidatedRestricted(PointsToRelation &, PointsToRelation *, CallInst *, LivenessSet *);
     LivenessSet getInvalidatedNodes(PointsToRelation *, CallInst *);
     PointsToData data;
-    PointsToNodeFactory factory;
+    // The factory is owned by the analysis unless it is a worker.
+    std::unique_ptr<PointsToNodeFactory> ownedFactory;
+    PointsToNodeFactory &factory;
+    // Caches the restrictions of interned relations to interned sets.
+    DenseMap<std::pair<const PointsToRelation *, const LivenessSet *>, const PointsToRelation *> restrictions;
+    // The results that only contain the information at block boundaries,
+    // with the context needed to compute the rest of the information.
+    DenseMap<const IntraproceduralPointsTo *, std::tuple<CallString, const PointsToRelation *, const LivenessSet *, bool>> blockLevelResults;
+    // The results of functions at a fixed point, keyed by the function, its
+    // boundary information and the profile of the call string, with the
+    // boundary information of the calls that it makes. Contexts with the same
+    // key have the same results, so they can be copied instead of solved.
+    typedef std::tuple<const Function *, const PointsToRelation *, const LivenessSet *, bool, CallString::Profile> ValueContextKey;
+    std::map<ValueContextKey, std::pair<IntraproceduralPointsTo, SmallVector<std::tuple<const CallInst *, const Function *, PointsToRelation, LivenessSet, bool>, 8>>> valueContexts;
+    // The join of the boundary information that each summary context has
+    // been reached with.
+    DenseMap<std::pair<std::pair<unsigned, unsigned>, const Function *>, std::tuple<const PointsToRelation *, const LivenessSet *, bool>> summaryBoundaries;
+    // The calls, with the call strings that they extend, that have been
+    // merged into summaries.
+    DenseSet<std::pair<std::pair<unsigned, unsigned>, const Instruction *>> mergedCalls;
+    // The nodes and call strings that this analysis has looked up in the
+    // shared factory and trie. Each worker has its own, so the shared ones
+    // are only locked the first time a worker needs something.
+    DenseMap<const Value *, PointsToNode *> nodeCache, noAliasNodeCache;
+    DenseMap<std::pair<std::pair<unsigned, unsigned>, const Instruction *>, CallString> extendedCallStrings;
+    // The nodes that a worker would have made summary nodes during the
+    // current parallel round.
+    SmallPtrSet<PointsToNode *, 8> pendingSummaryNodes;
+    // The result of a context as seen by its callers, with the facts that it
+    // was computed from.
+    struct CalleeSummary {
+        const LivenessSet *Lin = nullptr;
+        SmallVector<const PointsToRelation *, 2> Aouts;
+        const PointsToRelation *Aout = nullptr;
+    };
+    DenseMap<const IntraproceduralPointsTo *, CalleeSummary> calleeSummaries;
+    // The functions that each indirect call may call with each interned
+    // relation before it, and whether it may call something unknown.
+    struct IndirectTargets {
+        bool Unknown;
+        SmallVector<const Function *, 4> Functions;
+    };
+    DenseMap<std::pair<const CallInst *, const PointsToRelation *>, IndirectTargets> indirectTargets;
+    // Whether every access to memory made by each function, and by the
+    // functions that it calls, is seen by the analysis.
+    DenseMap<const Function *, bool> visibleAccesses;
+    // The model of each declared function that has been called, or nullptr.
+    DenseMap<const Function *, const LibraryModel *> libraryModels;
+    // The roots that haven't been analysed yet, when the module is analysed
+    // on demand.
+    DenseSet<const Function *> pendingRoots;
+    std::vector<const Function *> rootOrder;
+    // The functions that contain calls whose callee isn't known, which may
+    // call any function whose address is taken.
+    std::vector<const Function *> indirectlyCalling;
+    // The fingerprints of the functions when the module was last analysed,
+    // if the analysis is incremental.
+    DenseMap<const Function *, FunctionFingerprint> fingerprints;
+    // The contexts kept from the last run whose call strings pass through
+    // functions that are solved again. They are only kept if they are
+    // reached again with the same boundary information, or if a prefix of
+    // their call string is.
+    std::vector<std::pair<const Function *, CallString>> unvalidated;
+    DenseSet<std::pair<const Function *, std::pair<unsigned, unsigned>>> unvalidatedKeys;
+    DenseSet<std::pair<unsigned, unsigned>> validated;
+    // The instructions visited by the solver in each function.
+    DenseMap<const Function *, InstructionGraph *> graphs;
+    SpecificBumpPtrAllocator<InstructionGraph> graphAllocator;
+    // What the solver needs to know about the structure of each function.
+    DenseMap<const Function *, FunctionInfo *> infos;
+    SpecificBumpPtrAllocator<FunctionInfo> infoAllocator;
 };
 
 #endif
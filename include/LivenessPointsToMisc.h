@@ -8,19 +8,9 @@
 
 using namespace llvm;
 
-inline const Instruction *getNextInstruction(const Instruction *Instr)  {
-    BasicBlock::const_iterator I(Instr);
-    const Instruction *Next = ++I;
-    // There should be at least one more instruction in the basic block.
-    assert(Next != Instr->getParent()->end());
-    return Next;
-}
-
-inline const Instruction *getPreviousInstruction(const Instruction *Instr) {
-    BasicBlock::const_iterator I(Instr);
-    // There should be at least one instruction before Instr.
-    assert (I != Instr->getParent()->begin());
-    return --I;
+// Returns true if I is the first instruction or the terminator of its block.
+inline bool isBlockBoundary(const Instruction *I) {
+    return I == &I->getParent()->front() || isa<TerminatorInst>(I);
 }
 
 inline bool canHandleBitcast(const BitCastInst *I) {
@@ -0,0 +1,44 @@
+#ifndef LFCPA_LIVENESSPOINTSTOPASS_H
+#define LFCPA_LIVENESSPOINTSTOPASS_H
+
+#include <memory>
+
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+
+#include "LivenessPointsTo.h"
+
+using namespace llvm;
+
+// The analysis of a module as a pass, so that the passes that use its results
+// share one analysis. The module is only analysed when the results are first
+// asked for, and the results are kept for as long as the passes that run
+// after it preserve them.
+class LivenessPointsToPass : public ModulePass {
+    public:
+        static char ID;
+
+        LivenessPointsToPass() : ModulePass(ID) {}
+        bool runOnModule(Module &M) override;
+        void getAnalysisUsage(AnalysisUsage &AU) const override;
+        void releaseMemory() override;
+
+        // Returns the results for the whole module, analysing it if it
+        // hasn't been analysed yet.
+        LivenessPointsTo &getResult();
+        // Returns the analysis prepared to analyse each root when a value in
+        // it is first queried, unless the whole module has already been
+        // analysed.
+        LivenessPointsTo &getResultOnDemand();
+    private:
+        enum State { S_Unanalysed, S_OnDemand, S_Analysed };
+
+        Module *module = nullptr;
+        std::unique_ptr<LivenessPointsTo> analysis;
+        State state = S_Unanalysed;
+        // Set if the analysis holds the results of an earlier run, which an
+        // incremental analysis brings up to date.
+        bool kept = false;
+};
+
+#endif
@@ -1,26 +1,65 @@
 #ifndef LFCPA_LIVENESSSET_H
 #define LFCPA_LIVENESSSET_H
 
-#include <set>
+#include <iterator>
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/SparseBitVector.h"
 
 #include "PointsToNode.h"
 
 class LivenessSet {
     public:
-        typedef std::set<PointsToNode *>::iterator iterator;
-        typedef std::set<PointsToNode *>::const_iterator const_iterator;
-        typedef std::set<PointsToNode *>::size_type size_type;
+        typedef SparseBitVector<> container;
+        typedef unsigned size_type;
+
+        class const_iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef PointsToNode* value_type;
+            typedef signed difference_type;
+            typedef PointsToNode* const* pointer;
+            typedef PointsToNode* reference;
+
+            const_iterator(container::iterator I, const PointsToNodeTable *T) : I(I), T(T) {}
+
+            inline reference operator*() const { return T->getNode(*I); }
+
+            inline bool operator==(const const_iterator &Y) const { return I == Y.I; }
+            inline bool operator!=(const const_iterator &Y) const { return I != Y.I; }
+
+            const_iterator &operator++() {
+                ++I;
+                return *this;
+            }
+        private:
+            container::iterator I;
+            const PointsToNodeTable *T;
+        };
+        typedef const_iterator iterator;
 
         inline const_iterator begin() const {
-            return s.begin();
+            return const_iterator(s.begin(), nodes);
         }
 
         inline const_iterator find(PointsToNode *N) const {
-            return s.find(N);
+            // Bit vector iterators can't be positioned at a particular
+            // element, so this is linear; use count for membership tests.
+            if (!count(N))
+                return end();
+            for (auto I = begin(), E = end(); I != E; ++I)
+                if (*I == N)
+                    return I;
+            llvm_unreachable("The node should be in the set.");
         }
 
         inline const_iterator end() const {
-            return s.end();
+            return const_iterator(s.end(), nodes);
+        }
+
+        inline size_type count(const PointsToNode *N) const {
+            return s.test(N->getId()) ? 1 : 0;
         }
 
         inline bool empty() const {
@@ -28,7 +67,7 @@ class LivenessSet {
         }
 
         inline int size() const {
-            return s.size();
+            return s.count();
         }
 
         inline void clear() {
@@ -39,21 +78,30 @@ class LivenessSet {
             // When we kill a node, it's children (i.e. GEPs) are also killed.
             for (PointsToNode *Child : N->children) {
                 assert(isa<GEPPointsToNode>(Child) && "All children of PointsToNodes should be GEPs");
-                s.erase(Child);
+                s.reset(Child->getId());
             }
 
-            return s.erase(N);
+            if (!s.test(N->getId()))
+                return 0;
+            s.reset(N->getId());
+            return 1;
         }
 
         inline bool insert(PointsToNode *N) {
             if (N->singlePointee() || (!N->hasPointerType() && !N->isAlwaysSummaryNode()) || isa<UnknownPointsToNode>(N))
                 return false;
 
-            return s.insert(N).second;
+            if (s.test(N->getId()))
+                return false;
+            s.set(N->getId());
+            nodes = N->getTable();
+            return true;
         }
 
-        inline void insertAll(LivenessSet &L) {
-            s.insert(L.begin(), L.end());
+        inline void insertAll(const LivenessSet &L) {
+            s |= L.s;
+            if (nodes == nullptr)
+                nodes = L.nodes;
         }
 
         inline bool operator==(const LivenessSet &R) const {
@@ -64,29 +112,41 @@ class LivenessSet {
             return s!=R.s;
         }
 
-        void dump() const;
+        inline unsigned hash() const {
+            hash_code H = hash_value(0);
+            for (unsigned Id : s)
+                H = hash_combine(H, Id);
+            return H;
+        }
 
-        bool isSubset(LivenessSet &S) {
-            for (auto N : S) {
-                if (N->isAlwaysSummaryNode())
-                    continue;
+        void dump() const;
 
-                if (s.find(N) == s.end())
+        bool isSubset(const LivenessSet &S) const {
+            // Only the nodes of S that are missing from this set need to be
+            // looked at.
+            container missing;
+            missing.intersectWithComplement(S.s, s);
+            for (unsigned Id : missing)
+                if (!S.nodes->getNode(Id)->isAlwaysSummaryNode())
                     return false;
-            }
             return true;
         }
 
         void eraseNonSummaryNodes(const CallString &CS) {
-            for (auto I = s.begin(), E = s.end(); I != E; ) {
-                if (!(*I)->isSummaryNode(CS))
-                    I = s.erase(I);
-                else
-                    ++I;
-            }
+            SmallVector<unsigned, 16> toErase;
+            for (unsigned Id : s)
+                if (!nodes->getNode(Id)->isSummaryNode(CS))
+                    toErase.push_back(Id);
+            for (unsigned Id : toErase)
+                s.reset(Id);
         }
     private:
-        std::set<PointsToNode *> s;
+        // SparseBitVector::test caches the last element that it looked at, so
+        // it isn't const in older versions of LLVM.
+        mutable container s;
+        // The table of the IDs of the nodes, which is only known once a node
+        // has been added.
+        const PointsToNodeTable *nodes = nullptr;
 };
 
 #endif
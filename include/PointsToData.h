@@ -1,12 +1,16 @@
 #ifndef LFCPA_POINTSTODATA_H
 #define LFCPA_POINTSTODATA_H
 
+#include <map>
 #include <set>
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/IR/Function.h"
+#include "llvm/Support/Allocator.h"
 
 #include "CallString.h"
+#include "InternTable.h"
 #include "LivenessSet.h"
 #include "PointsToNode.h"
 #include "PointsToRelation.h"
@@ -14,22 +18,134 @@
 using namespace llvm;
 
 typedef std::tuple<CallInst *, Function *, PointsToRelation *, LivenessSet, bool> CallData;
-typedef DenseMap<const Instruction *, std::pair<LivenessSet *, PointsToRelation *>> IntraproceduralPointsTo;
-typedef SmallVector<std::tuple<CallString, IntraproceduralPointsTo *, PointsToRelation, LivenessSet>, 8> ProcedurePointsTo;
+// The sets and relations are interned by PointsToData, so they can be shared
+// between instructions and compared by pointer.
+typedef DenseMap<const Instruction *, std::pair<const LivenessSet *, const PointsToRelation *>> IntraproceduralPointsTo;
 
-bool arePointsToMapsEqual(const Function *F, IntraproceduralPointsTo *a, IntraproceduralPointsTo &b);
-IntraproceduralPointsTo copyPointsToMap(IntraproceduralPointsTo *);
+// The contexts at which a function has been analysed, in the order in which
+// they were created. Each context is the call string, the results, and the
+// (interned) boundary information. Contexts are indexed by call string; cyclic
+// call strings may match many call strings, so they are kept separately.
+class ProcedurePointsTo {
+    public:
+        typedef std::tuple<CallString, IntraproceduralPointsTo *, const PointsToRelation *, const LivenessSet *> Entry;
+        typedef std::map<unsigned, Entry> container;
+
+        class const_iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef Entry value_type;
+            typedef signed difference_type;
+            typedef const Entry* pointer;
+            typedef const Entry& reference;
+
+            const_iterator(container::const_iterator I) : I(I) {}
+
+            inline reference operator*() const { return I->second; }
+            inline pointer operator->() const { return &I->second; }
+
+            inline bool operator==(const const_iterator &Y) const { return I == Y.I; }
+            inline bool operator!=(const const_iterator &Y) const { return I != Y.I; }
+
+            const_iterator &operator++() {
+                ++I;
+                return *this;
+            }
+        private:
+            container::const_iterator I;
+        };
+
+        inline const_iterator begin() const {
+            return const_iterator(entries.begin());
+        }
+
+        inline const_iterator end() const {
+            return const_iterator(entries.end());
+        }
+
+        inline unsigned size() const {
+            return entries.size();
+        }
 
+        inline bool empty() const {
+            return entries.empty();
+        }
+
+        // Returns the entry with exactly the call string CS, or nullptr.
+        Entry *find(const CallString &CS);
+        // Returns an entry with a cyclic call string that matches CS, or
+        // nullptr.
+        Entry *findCyclicMatch(const CallString &CS);
+        // Returns the entries (in order of creation) whose call strings are
+        // empty or end in the same call or called function as CS.
+        SmallVector<Entry *, 4> findWithSameLastCall(const CallString &CS);
+        void insert(const Entry &);
+        // Replaces an entry, keeping its position in the order.
+        void replace(Entry *, const Entry &);
+        void erase(const CallString &);
+    private:
+        void addToIndex(unsigned, const CallString &);
+        void removeFromIndex(unsigned, const CallString &);
+
+        unsigned nextPosition = 0;
+        container entries;
+        DenseMap<std::pair<unsigned, unsigned>, unsigned> byCallString;
+        DenseMap<const Instruction *, SmallVector<unsigned, 2>> byLastCall;
+        DenseMap<const Function *, SmallVector<unsigned, 2>> byLastCalledFunction;
+        SmallVector<unsigned, 4> cyclic;
+};
+
+bool arePointsToMapsEqual(const Function *F, const IntraproceduralPointsTo *a, const IntraproceduralPointsTo &b);
+
+// Owns the results of the analysis. The results are allocated in an arena and
+// freed in bulk when the data is destroyed; results which are discarded during
+// the analysis are kept until then, since they may still be in use further up
+// the stack. The interned facts are freed when they are swept, once nothing
+// that is still in use refers to them.
 class PointsToData {
     public:
         PointsToData() {}
         ProcedurePointsTo *getAtFunction(const Function *) const;
-        IntraproceduralPointsTo *getPointsTo(const CallString &, const Function *, PointsToRelation &, LivenessSet &, bool &);
+        IntraproceduralPointsTo *getPointsTo(const CallString &, const Function *, const PointsToRelation &, const LivenessSet &, bool BlockBoundariesOnly, bool &);
         bool attemptMakeCyclicCallString(const Function *, const CallString &, IntraproceduralPointsTo *);
         bool hasDataForFunction(const Function *) const;
         IntraproceduralPointsTo *get(const Function *, const CallString &) const;
+        // Adds the contexts in Other, whose call strings must be different
+        // from those here. The results and their facts are copied into this
+        // data, so Other may be destroyed afterwards; Copies is set to the
+        // copy of each of Other's results.
+        void merge(const PointsToData &Other, DenseMap<const IntraproceduralPointsTo *, IntraproceduralPointsTo *> &Copies);
+        // Discards every context of the function. Its results are kept until
+        // the data is destroyed.
+        void eraseFunction(const Function *);
+        // Returns true if enough facts have been interned since the last
+        // sweep for another one to be worthwhile.
+        bool shouldSweep() const;
+        // Frees the facts that aren't used by the contexts or in Sets and
+        // Relations, which are extended with the facts of the contexts. The
+        // results of discarded contexts may refer to freed facts afterwards.
+        void sweep(DenseSet<const LivenessSet *> &Sets, DenseSet<const PointsToRelation *> &Relations);
+
+        inline const LivenessSet *intern(const LivenessSet &L) {
+            return livenessSets.intern(L);
+        }
+        inline const PointsToRelation *intern(const PointsToRelation &R) {
+            return relations.intern(R);
+        }
+        inline const LivenessSet *getEmptyLivenessSet() const {
+            return livenessSets.getEmpty();
+        }
+        inline const PointsToRelation *getEmptyRelation() const {
+            return relations.getEmpty();
+        }
     private:
+        ProcedurePointsTo *getOrCreateAtFunction(const Function *);
+
         DenseMap<const Function *, ProcedurePointsTo *> data;
+        SpecificBumpPtrAllocator<ProcedurePointsTo> procedureAllocator;
+        SpecificBumpPtrAllocator<IntraproceduralPointsTo> mapAllocator;
+        InternTable<LivenessSet> livenessSets;
+        InternTable<PointsToRelation> relations;
 };
 
 #endif
@@ -0,0 +1,50 @@
+#ifndef LFCPA_POINTSTOINDEX_H
+#define LFCPA_POINTSTOINDEX_H
+
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Module.h"
+
+#include "LivenessPointsTo.h"
+
+using namespace llvm;
+
+// A read-only index of the results, joined over the contexts, built once the
+// analysis has finished. The pointees of each pointer in an analysed function
+// are kept as sorted node IDs in one array, followed by the IDs of the nodes
+// that they are sub-nodes of (including themselves). Two pointers may alias
+// exactly when the pointees of either intersect the ancestors of the other.
+class PointsToIndex {
+    public:
+        struct Entry {
+            ArrayRef<unsigned> Pointees, Ancestors;
+            bool AllowMustAlias;
+        };
+
+        void build(Module &M, LivenessPointsTo &Analysis);
+        // Returns false if V isn't in the index. An entry without pointees
+        // means that what V points to isn't known.
+        bool lookup(const Value *V, Entry &E) const;
+        // Forgets V, which is about to be deleted.
+        void erase(const Value *V) {
+            records.erase(V);
+        }
+        // Sets Pointees to the sorted IDs of the nodes, and Ancestors to those
+        // of the nodes that they are sub-nodes of.
+        static void collectIds(ArrayRef<PointsToNode *> Nodes, SmallVectorImpl<unsigned> &Pointees, SmallVectorImpl<unsigned> &Ancestors);
+        // Returns true if the two sorted arrays have an element in common.
+        static bool intersects(ArrayRef<unsigned> A, ArrayRef<unsigned> B);
+    private:
+        struct Record {
+            unsigned Offset, NumPointees, NumAncestors;
+            bool AllowMustAlias;
+        };
+
+        std::vector<unsigned> ids;
+        DenseMap<const Value *, Record> records;
+};
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef LFCPA_POINTSTONODE_H
 #define LFCPA_POINTSTONODE_H
 
+#include <atomic>
+#include <memory>
 #include <sstream>
+#include <vector>
 
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Constants.h"
@@ -19,6 +22,97 @@
 using namespace llvm;
 
 class GEPPointsToNode;
+class PointsToNode;
+
+// The children of a node. Children are only ever appended, and they are
+// linked through atomic pointers, so the list can be read by one thread while
+// another thread adds to it. Appending must be synchronised by the caller.
+class ChildList {
+    public:
+        class const_iterator {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef PointsToNode* value_type;
+            typedef signed difference_type;
+            typedef PointsToNode* const* pointer;
+            typedef PointsToNode* reference;
+
+            const_iterator(PointsToNode *N) : N(N) {}
+
+            inline reference operator*() const { return N; }
+
+            inline bool operator==(const const_iterator &Y) const { return N == Y.N; }
+            inline bool operator!=(const const_iterator &Y) const { return N != Y.N; }
+
+            inline const_iterator &operator++();
+        private:
+            PointsToNode *N;
+        };
+
+        inline const_iterator begin() const {
+            return const_iterator(first.load(std::memory_order_acquire));
+        }
+
+        inline const_iterator end() const {
+            return const_iterator(nullptr);
+        }
+
+        inline bool empty() const {
+            return first.load(std::memory_order_acquire) == nullptr;
+        }
+
+        inline void push_back(PointsToNode *N);
+    private:
+        std::atomic<PointsToNode *> first{nullptr};
+        PointsToNode *last = nullptr;
+};
+
+// Gives every node of an analysis a dense ID, so that sets of nodes can be
+// represented as bit vectors, and finds the node with an ID. IDs aren't reused
+// while the table exists. The table is split into chunks which are never
+// moved, so nodes can be looked up while other threads add nodes.
+class PointsToNodeTable {
+    private:
+        static const unsigned ChunkBits = 12, MaxChunks = 1 << 16;
+        std::unique_ptr<std::atomic<PointsToNode **>[]> chunks;
+        std::atomic<unsigned> nextId{0}, nextName{0};
+    public:
+        PointsToNodeTable() : chunks(new std::atomic<PointsToNode **>[MaxChunks]()) {}
+        ~PointsToNodeTable() {
+            for (unsigned C = 0; C != MaxChunks; ++C)
+                delete[] chunks[C].load(std::memory_order_relaxed);
+        }
+        PointsToNodeTable(const PointsToNodeTable &) = delete;
+        PointsToNodeTable &operator=(const PointsToNodeTable &) = delete;
+
+        unsigned add(PointsToNode *N) {
+            unsigned Id = nextId.fetch_add(1, std::memory_order_relaxed);
+            assert((Id >> ChunkBits) < MaxChunks && "Too many nodes.");
+            std::atomic<PointsToNode **> &Slot = chunks[Id >> ChunkBits];
+            PointsToNode **Chunk = Slot.load(std::memory_order_acquire);
+            if (Chunk == nullptr) {
+                // Another thread may be adding the first node of the chunk.
+                PointsToNode **New = new PointsToNode *[1 << ChunkBits]();
+                if (Slot.compare_exchange_strong(Chunk, New, std::memory_order_acq_rel))
+                    Chunk = New;
+                else
+                    delete[] New;
+            }
+            // The node is published to other threads by whatever makes the
+            // node itself visible to them.
+            Chunk[Id & ((1 << ChunkBits) - 1)] = N;
+            return Id;
+        }
+        inline PointsToNode *getNode(unsigned Id) const {
+            PointsToNode **Chunk = chunks[Id >> ChunkBits].load(std::memory_order_acquire);
+            assert(Chunk != nullptr && Chunk[Id & ((1 << ChunkBits) - 1)] != nullptr && "Unknown node ID.");
+            return Chunk[Id & ((1 << ChunkBits) - 1)];
+        }
+        // Returns a number for naming an unnamed value.
+        inline unsigned getFreshName() {
+            return nextName.fetch_add(1, std::memory_order_relaxed);
+        }
+};
 
 class PointsToNode {
 public:
@@ -34,17 +128,26 @@ public:
     friend class PointsToNodeFactory;
     friend class LivenessSet;
     friend class LivenessPointsTo;
+    friend class ChildList;
 private:
     const PointsToNodeKind Kind;
+    PointsToNodeTable *table;
+    const unsigned id;
+    std::atomic<PointsToNode *> nextSibling{nullptr};
 protected:
     StringRef name;
-    static int nextId;
-    bool summaryNode = false, summaryNodePointees = false, fieldSensitive = true;
+    std::atomic<bool> summaryNode{false}, summaryNodePointees{false}, fieldSensitive{true};
 
-    PointsToNode(PointsToNodeKind K) : Kind(K) {}
+    PointsToNode(PointsToNodeKind K, PointsToNodeTable &T) : Kind(K), table(&T), id(T.add(this)) {}
 public:
-    SmallVector<PointsToNode *, 4> children;
+    virtual ~PointsToNode() {}
+
+    ChildList children;
     PointsToNodeKind getKind() const { return Kind; }
+    inline unsigned getId() const { return id; }
+    // The table that the ID of the node is in, which is used to find the
+    // nodes of the sets that the node is added to.
+    inline const PointsToNodeTable *getTable() const { return table; }
 
     virtual bool hasPointerType() const { return false; }
     virtual bool multipleStackFrames() const { return false; }
@@ -100,11 +203,33 @@ public:
     }
 };
 
+ChildList::const_iterator &ChildList::const_iterator::operator++() {
+    N = N->nextSibling.load(std::memory_order_acquire);
+    return *this;
+}
+
+void ChildList::push_back(PointsToNode *N) {
+    // The node is published by the store, so it must be fully constructed.
+    if (last == nullptr)
+        first.store(N, std::memory_order_release);
+    else
+        last->nextSibling.store(N, std::memory_order_release);
+    last = N;
+}
+
+// Orders nodes by ID. This is used instead of comparing pointers so that the
+// order matches the iteration order of LivenessSet.
+struct PointsToNodeLess {
+    inline bool operator()(const PointsToNode *A, const PointsToNode *B) const {
+        return A->getId() < B->getId();
+    }
+};
+
 class UnknownPointsToNode : public PointsToNode {
     private:
         std::string stdName;
     public:
-        UnknownPointsToNode() : PointsToNode(PTNK_Unknown), stdName("?") {
+        UnknownPointsToNode(PointsToNodeTable &T) : PointsToNode(PTNK_Unknown, T), stdName("?") {
             name = StringRef(stdName);
         }
 
@@ -138,18 +263,19 @@ class ValuePointsToNode : public PointsToNode {
         bool isPointer, userOrArg;
         PointsToNode *Pointee;
     public:
-        ValuePointsToNode(const Value *V, PointsToNode *Pointee) : PointsToNode(PTNK_Value), Pointee(Pointee) {
+        const Value *Val;
+        ValuePointsToNode(PointsToNodeTable &T, const Value *V, PointsToNode *Pointee) : PointsToNode(PTNK_Value, T), Pointee(Pointee), Val(V) {
             assert(V != nullptr);
             name = V->getName();
             if (name == "") {
-                stdName = std::to_string(nextId++);
+                stdName = std::to_string(T.getFreshName());
                 name = StringRef(stdName);
             }
             isPointer = getEffectiveType(V)->isPointerTy();
             userOrArg = isa<User>(V) || isa<Argument>(V);
         }
 
-        ValuePointsToNode(const Value *V) : ValuePointsToNode(V, nullptr) {}
+        ValuePointsToNode(PointsToNodeTable &T, const Value *V) : ValuePointsToNode(T, V, nullptr) {}
 
         bool hasPointerType() const override { return isPointer; }
         bool multipleStackFrames() const override { return userOrArg; }
@@ -170,7 +296,7 @@ class GlobalPointsToNode : public PointsToNode {
         std::string stdName;
         bool isPointer;
     public:
-        GlobalPointsToNode(const GlobalObject *G) : PointsToNode(PTNK_Global), Object(G) {
+        GlobalPointsToNode(PointsToNodeTable &T, const GlobalObject *G) : PointsToNode(PTNK_Global, T), Object(G) {
            stdName = "global:" + G->getName().str();
            name = StringRef(stdName);
            auto GTy = getEffectiveType(G);
@@ -180,6 +306,10 @@ class GlobalPointsToNode : public PointsToNode {
 
         bool hasPointerType() const override { return isPointer; }
 
+        inline const GlobalObject *getObject() const {
+            return Object;
+        }
+
         const Function *getFunction() const override {
             if (const Function *F = dyn_cast<Function>(Object)) {
                 return F;
@@ -195,7 +325,7 @@ class GlobalPointsToNode : public PointsToNode {
 
 class InitPointsToNode : public PointsToNode {
     public:
-        InitPointsToNode() : PointsToNode(PTNK_Init) {
+        InitPointsToNode(PointsToNodeTable &T) : PointsToNode(PTNK_Init, T) {
             name = "init";
             summaryNode = true;
             fieldSensitive = false;
@@ -216,15 +346,18 @@ class NoAliasPointsToNode : public PointsToNode {
         bool isPointer;
     public:
         const Function *Definer;
-        NoAliasPointsToNode(const AllocaInst *AI) : PointsToNode(PTNK_NoAlias), Definer(AI->getParent()->getParent()) {
+        // The alloca or call that creates the memory.
+        const Instruction *Site;
+        NoAliasPointsToNode(PointsToNodeTable &T, const AllocaInst *AI) : PointsToNode(PTNK_NoAlias, T), Definer(AI->getParent()->getParent()), Site(AI) {
             stdName = "alloca:" + AI->getName().str();
             name = StringRef(stdName);
             auto Ty = getEffectiveType(AI);
             assert(Ty->isPointerTy());
             isPointer = Ty->getPointerElementType()->isPointerTy();
         }
-        NoAliasPointsToNode(const CallInst *CI) : PointsToNode(PTNK_NoAlias), Definer(CI->getParent()->getParent()) {
-            assert(CI->paramHasAttr(0, Attribute::NoAlias));
+        // The call either returns a noalias pointer or is modelled as an
+        // allocation.
+        NoAliasPointsToNode(PointsToNodeTable &T, const CallInst *CI) : PointsToNode(PTNK_NoAlias, T), Definer(CI->getParent()->getParent()), Site(CI) {
             stdName = "noalias:" + CI->getName().str();
             name = StringRef(stdName);
             auto Ty = getEffectiveType(CI);
@@ -262,7 +395,7 @@ class GEPPointsToNode : public PointsToNode {
     public:
         const Type *NodeType;
         SmallVector<APInt, 8> indices;
-        GEPPointsToNode(PointsToNode *Parent, const Type *Type, SmallVector<APInt, 8> indices, PointsToNode *Pointee) : PointsToNode(PTNK_GEP), Parent(Parent), Pointee(Pointee), NodeType(Type), indices(indices) {
+        GEPPointsToNode(PointsToNode *Parent, const Type *Type, SmallVector<APInt, 8> indices, PointsToNode *Pointee) : PointsToNode(PTNK_GEP, *Parent->table), Parent(Parent), Pointee(Pointee), NodeType(Type), indices(indices) {
             assert(!indices.empty());
             assert(isa<GEPPointsToNode>(Parent) || indices.begin()->getZExtValue() == 0);
             pointerType = Type->isPointerTy();
@@ -274,7 +407,6 @@ class GEPPointsToNode : public PointsToNode {
                 ns << I.getZExtValue();
                 ns << "]";
             }
-            Parent->children.push_back(this);
             stdName = ns.str();
             name = StringRef(stdName);
 
@@ -295,8 +427,12 @@ class GEPPointsToNode : public PointsToNode {
 
             assert(Pointee == nullptr || Parent->singlePointee());
             assert(Parent->isFieldSensitive());
+
+            // Adding the node to its parent makes it visible to other
+            // threads, so this is done last.
+            Parent->children.push_back(this);
         }
-        GEPPointsToNode(PointsToNode *Parent, const Type *Type, User::const_op_iterator I, User::const_op_iterator E, PointsToNode *Pointee) : PointsToNode(PTNK_GEP), Parent(Parent), Pointee(Pointee), NodeType(Type) {
+        GEPPointsToNode(PointsToNode *Parent, const Type *Type, User::const_op_iterator I, User::const_op_iterator E, PointsToNode *Pointee) : PointsToNode(PTNK_GEP, *Parent->table), Parent(Parent), Pointee(Pointee), NodeType(Type) {
             assert(I != E);
             assert(isa<ConstantInt>(I) && "Can only treat GEPs with constant indices field-sensitively.");
             assert(isa<GEPPointsToNode>(Parent) || cast<ConstantInt>(I)->isZero());
@@ -312,7 +448,6 @@ class GEPPointsToNode : public PointsToNode {
                 ns << Int->getZExtValue();
                 ns << "]";
             }
-            Parent->children.push_back(this);
             stdName = ns.str();
             name = StringRef(stdName);
 
@@ -333,6 +468,10 @@ class GEPPointsToNode : public PointsToNode {
 
             assert(Pointee == nullptr || Parent->singlePointee());
             assert(Parent->isFieldSensitive());
+
+            // Adding the node to its parent makes it visible to other
+            // threads, so this is done last.
+            Parent->children.push_back(this);
         }
 
         GEPPointsToNode(PointsToNode *Parent, const Type *Type, const GEPOperator *V, PointsToNode *Pointee) : GEPPointsToNode(Parent, Type, V->idx_begin(), V->idx_end(), Pointee) { }
@@ -1,29 +1,58 @@
 #ifndef LFCPA_POINTSTONODEFACTORY_H
 #define LFCPA_POINTSTONODEFACTORY_H
 
+#include <mutex>
+
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/IR/Operator.h"
 #include "llvm/IR/Value.h"
 
 #include "PointsToNode.h"
 
+// Creates and owns the nodes. The nodes are allocated in arenas and are all
+// destroyed with the factory, along with the table of their IDs. The factory
+// may be shared between threads.
 class PointsToNodeFactory {
     private:
+        // Looking up a node may create others, so the lock is recursive.
+        std::recursive_mutex lock;
+        // This is declared before the nodes, which are added to it.
+        PointsToNodeTable table;
+        SpecificBumpPtrAllocator<ValuePointsToNode> valueNodes;
+        SpecificBumpPtrAllocator<GlobalPointsToNode> globalNodes;
+        SpecificBumpPtrAllocator<NoAliasPointsToNode> noAliasNodes;
+        SpecificBumpPtrAllocator<GEPPointsToNode> gepNodes;
         DenseMap<const Value *, PointsToNode *> map;
         DenseMap<const Value *, PointsToNode *> noAliasMap;
         DenseMap<const GlobalObject *, PointsToNode *> globalMap;
         UnknownPointsToNode unknown;
         InitPointsToNode init;
         bool matchGEPNode(const GEPOperator *, const PointsToNode *) const;
-        PointsToNode *getGEPNode(const GEPOperator *, const Type *Type, PointsToNode *, PointsToNode *) const;
+        PointsToNode *getGEPNode(const GEPOperator *, const Type *Type, PointsToNode *, PointsToNode *);
     public:
+        PointsToNodeFactory() : unknown(table), init(table) {}
         PointsToNode *getUnknown();
         PointsToNode *getInit();
         PointsToNode *getNode(const Value *);
         PointsToNode *getNoAliasNode(const AllocaInst *);
         PointsToNode *getNoAliasNode(const CallInst *);
         PointsToNode *getGlobalNode(const GlobalObject *);
+        // Forgets the nodes of the values, which may have been freed, so that
+        // values created at the same addresses get new nodes. The nodes
+        // themselves are kept until the factory is destroyed.
+        void forget(ArrayRef<const Value *>);
         PointsToNode *getIndexedNode(PointsToNode *, const GEPOperator *);
+        GEPPointsToNode *createGEPNode(PointsToNode *, const Type *, const SmallVector<APInt, 8> &, PointsToNode *);
+        inline PointsToNode *getNodeWithId(unsigned Id) const {
+            return table.getNode(Id);
+        }
+        // Locks the factory, so that a thread can check which nodes exist
+        // and create the missing ones without another thread doing the same.
+        inline std::unique_lock<std::recursive_mutex> lockNodes() {
+            return std::unique_lock<std::recursive_mutex>(lock);
+        }
 };
 
 #endif
@@ -3,13 +3,72 @@
 
 #include <set>
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SparseBitVector.h"
+
 #include "LivenessSet.h"
 #include "PointsToNode.h"
 
 class PointsToRelation {
 public:
-    typedef std::set<std::pair<PointsToNode *, PointsToNode *>> container;
-    typedef container::const_iterator const_iterator;
+    // The relation is indexed by the ID of the pointer, and the pointees of
+    // each pointer are stored as a bit vector of node IDs. Pointers without
+    // any pointees don't have an entry.
+    typedef SparseBitVector<> PointeeSet;
+    typedef SmallDenseMap<unsigned, PointeeSet, 4> container;
+
+    // Iterates over every pair in the relation.
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<PointsToNode *, PointsToNode *> value_type;
+        typedef signed difference_type;
+        typedef std::pair<PointsToNode *, PointsToNode *> const* pointer;
+        typedef std::pair<PointsToNode *, PointsToNode *> const& reference;
+
+        const_iterator(container::const_iterator MI, container::const_iterator ME, const PointsToNodeTable *T) : MI(MI), ME(ME), BI(emptyPointees.end()), BE(emptyPointees.end()), T(T) {
+            if (MI != ME) {
+                BI = MI->second.begin();
+                BE = MI->second.end();
+                advance_iterators();
+            }
+        }
+
+        inline reference operator*() const { return Current; }
+        inline pointer operator->() const { return &Current; }
+
+        inline bool operator==(const const_iterator &Y) const {
+            return MI == Y.MI && (MI == ME || BI == Y.BI);
+        }
+        inline bool operator !=(const const_iterator &Y) const {
+            return !operator==(Y);
+        }
+
+        const_iterator &operator++() {
+            ++BI;
+            advance_iterators();
+            return *this;
+        }
+    private:
+        inline void advance_iterators() {
+            // Move on to the next pointer once all of the pointees of the
+            // current one have been seen.
+            while (BI == BE) {
+                ++MI;
+                if (MI == ME)
+                    return;
+                BI = MI->second.begin();
+                BE = MI->second.end();
+            }
+            Current = std::make_pair(T->getNode(MI->first), T->getNode(*BI));
+        }
+
+        container::const_iterator MI, ME;
+        PointeeSet::iterator BI, BE;
+        const PointsToNodeTable *T;
+        value_type Current;
+    };
 
     class const_pointee_iterator {
     public:
@@ -17,26 +76,20 @@ public:
         typedef PointsToNode* value_type;
         typedef signed difference_type;
         typedef PointsToNode* const* pointer;
-        typedef PointsToNode* const& reference;
+        typedef PointsToNode* reference;
 
-        const_pointee_iterator(const_iterator I, const_iterator E, const PointsToNode *N) : single_value(false), E(E), Value(nullptr), N(N) {
-            while (I != E && I->first != N) {
-                ++I;
-            }
-            this->I = I;
-        }
+        const_pointee_iterator(PointeeSet::iterator I, const PointsToNodeTable *T) : single_value(false), I(I), Value(nullptr), T(T) {}
 
-        const_pointee_iterator(PointsToNode *Value) : single_value(true), Value(Value) {}
+        const_pointee_iterator(PointsToNode *Value) : single_value(true), I(emptyPointees.end()), Value(Value), T(nullptr) {}
 
-        inline reference operator*() const { return single_value ? Value : I->second; }
-        inline pointer operator->() const { return &operator*(); }
+        inline reference operator*() const { return single_value ? Value : T->getNode(*I); }
 
         inline bool operator==(const const_pointee_iterator &Y) const {
             assert (single_value == Y.single_value);
             if (single_value)
                 return Value == Y.Value;
             else
-                return I == Y.I || (I == E && Y.I == Y.E);
+                return I == Y.I;
         }
         inline bool operator !=(const const_pointee_iterator &Y) const {
             return !operator==(Y);
@@ -47,26 +100,26 @@ public:
                 assert(Value);
                 Value = nullptr;
             }
-            else {
-                do {
-                    ++I;
-                } while (I != E && I->first != N);
-            }
+            else
+                ++I;
             return *this;
         }
-
-        inline bool atEnd() const { return single_value ? Value == nullptr : I == E; }
     private:
         // This is very ugly -- it essentially implemented two different
         // iterators with one class. However, it is significantly simpler than
         // any alternatives.
         bool single_value;
-        const_iterator I, E;
+        PointeeSet::iterator I;
         PointsToNode *Value;
-        const PointsToNode *N;
+        const PointsToNodeTable *T;
     };
 
-    class const_restriction_iterator {
+    // Iterates over the pairs in the relation whose first component is in a
+    // set of nodes. Each node of the set is looked up in the index, so the
+    // cost depends on the size of the set rather than the size of the
+    // relation.
+    template <typename SetIterator>
+    class restriction_iterator {
     public:
         typedef std::forward_iterator_tag iterator_category;
         typedef std::pair<PointsToNode *, PointsToNode *> value_type;
@@ -74,74 +127,77 @@ public:
         typedef std::pair<PointsToNode *, PointsToNode *> const* pointer;
         typedef std::pair<PointsToNode *, PointsToNode *> const& reference;
 
-        const_restriction_iterator(const_iterator I, const_iterator E, std::set<PointsToNode *>::const_iterator DI, std::set<PointsToNode *>::const_iterator DE) : I(I), E(E), DI(DI), DE(DE), useSinglePointee(false) {
+        restriction_iterator(const container &M, SetIterator DI, SetIterator DE) : M(&M), DI(DI), DE(DE), useSinglePointee(false), BI(emptyPointees.end()), BE(emptyPointees.end()) {
             advance_iterators();
         }
 
-        inline reference operator*() const {
-            if (useSinglePointee)
-                return singlePointeePair;
-            else
-                return *I;
-        }
-        inline pointer operator->() const { return &operator*(); }
+        inline reference operator*() const { return Current; }
+        inline pointer operator->() const { return &Current; }
 
-        inline bool operator==(const const_restriction_iterator &Y) const {
-            if (useSinglePointee)
-                return Y.useSinglePointee && singlePointeePair == Y.singlePointeePair;
-            else
-                return !Y.useSinglePointee && (I == Y.I || (I == E && Y.I == Y.E));
+        inline bool operator==(const restriction_iterator &Y) const {
+            return DI == Y.DI && (DI == DE || (useSinglePointee == Y.useSinglePointee && BI == Y.BI));
         }
-        inline bool operator !=(const const_restriction_iterator &Y) const {
+        inline bool operator !=(const restriction_iterator &Y) const {
             return !operator==(Y);
         }
 
-        const_restriction_iterator &operator++() {
+        restriction_iterator &operator++() {
             if (useSinglePointee) {
                 useSinglePointee = false;
                 ++DI;
             }
-            else
-                ++I;
+            else if (++BI == BE)
+                ++DI;
             advance_iterators();
             return *this;
         }
 
-        inline bool atEnd() const { return I == E; }
+        inline bool atEnd() const { return DI == DE; }
     private:
         inline void advance_iterators() {
             assert(!useSinglePointee);
-            // Increment I zero or more times, until its first component is in
-            // DI..DE (or until the end is reached), and advance DI until it
-            // reaches I (or until the end is reached).
-            std::less<PointsToNode *> l;
-            while (I != E && DI != DE && I->first != *DI) {
-                // Advance DI until it is greater than or equal to I->first, or
-                // a value that has a single pointee is found.
-                while (DI != DE && !(*DI)->singlePointee() && l(*DI, I->first)) ++DI;
-                if (DI == DE)
-                    break;
-                else if ((*DI)->singlePointee()) {
+            if (BI != BE) {
+                // There are more pointees of the current node.
+                Current.second = Current.first->getTable()->getNode(*BI);
+                return;
+            }
+
+            // Advance DI until it reaches a node that has a single pointee or
+            // an entry in the relation (or until the end is reached).
+            for (; DI != DE; ++DI) {
+                PointsToNode *N = *DI;
+                if (N->singlePointee()) {
                     useSinglePointee = true;
-                    singlePointeePair = std::make_pair(*DI, (*DI)->getSinglePointee());
-                    break;
+                    Current = std::make_pair(N, N->getSinglePointee());
+                    return;
                 }
-                // Advance I until I->first is greater than or equal to DI.
-                while (I != E && l(I->first, *DI)) ++I;
-            }
 
-            if (DI == DE)
-                I = E;
+                auto Entry = M->find(N->getId());
+                if (Entry != M->end()) {
+                    BI = Entry->second.begin();
+                    BE = Entry->second.end();
+                    Current = std::make_pair(N, N->getTable()->getNode(*BI));
+                    return;
+                }
+            }
         }
 
-        const_iterator I, E;
-        std::set<PointsToNode *>::const_iterator DI, DE;
+        const container *M;
+        SetIterator DI, DE;
         bool useSinglePointee;
-        std::pair<PointsToNode *, PointsToNode *> singlePointeePair;
+        PointeeSet::iterator BI, BE;
+        value_type Current;
     };
 
-    inline void insertAll(PointsToRelation &R) {
-        s.insert(R.s.begin(), R.s.end());
+    typedef std::set<PointsToNode *, PointsToNodeLess> NodeSet;
+    typedef restriction_iterator<LivenessSet::const_iterator> const_restriction_iterator;
+    typedef restriction_iterator<NodeSet::const_iterator> const_node_restriction_iterator;
+
+    inline void insertAll(const PointsToRelation &R) {
+        for (auto &P : R.s)
+            s[P.first] |= P.second;
+        if (nodes == nullptr)
+            nodes = R.nodes;
     }
 
     inline void clear() {
@@ -159,111 +215,123 @@ public:
         if (isa<UnknownPointsToNode>(N.first) || (!N.first->hasPointerType() && !N.first->isAlwaysSummaryNode()))
             return false;
 
-        return s.insert(N).second;
+        PointeeSet &Pointees = s[N.first->getId()];
+        if (Pointees.test(N.second->getId()))
+            return false;
+        Pointees.set(N.second->getId());
+        nodes = N.first->getTable();
+        return true;
     }
 
-    inline void unionRelationRestriction(PointsToRelation &R, LivenessSet &S) {
-        auto RI = R.s.begin(), RE = R.s.end();
-        auto SI = S.begin(), SE = S.end();
-        auto I = s.begin(), E = s.end();
-        std::less<PointsToNode *> ln;
-        std::less<std::pair<PointsToNode *, PointsToNode *>> l;
-
-        while (RI != RE && SI != SE) {
-            // Find the first element of R that needs inserting.
-            while (*SI != RI->first) {
-                while (SI != SE && ln(*SI, RI->first)) ++SI;
-                if (SI == SE) return;
-                while (RI != RE && ln(RI->first, *SI)) ++RI;
-                if (RI == RE) return;
-            }
-            // At this point, *SI == RI->first, and neither iterator has reached
-            // the end.
+    inline void unionRelationRestriction(const PointsToRelation &R, const LivenessSet &S) {
+        assert(&R != this && "A relation can't be unioned with itself.");
+        for (auto &P : R.s)
+            if (S.count(R.nodes->getNode(P.first)))
+                s[P.first] |= P.second;
+        if (nodes == nullptr)
+            nodes = R.nodes;
+    }
 
-            // Find the position to insert the next value at.
-            while (I != E && l(*I, *RI)) ++I;
+    inline bool operator==(const PointsToRelation &R) const {
+        if (s.size() != R.s.size())
+            return false;
 
-            s.emplace_hint(I, *RI);
-            ++RI;
+        for (auto &P : s) {
+            auto Q = R.s.find(P.first);
+            if (Q == R.s.end() || Q->second != P.second)
+                return false;
         }
+        return true;
     }
 
-    inline bool operator==(const PointsToRelation &R) const {
-        return s==R.s;
+    inline bool operator!=(const PointsToRelation &R) const {
+        return !operator==(R);
     }
 
-    inline bool operator!=(const PointsToRelation &R) const {
-        return s!=R.s;
+    inline unsigned hash() const {
+        // The index isn't ordered, so the hashes of the entries are combined
+        // in a way that doesn't depend on the order.
+        size_t H = s.size();
+        for (auto &P : s) {
+            hash_code E = hash_value(P.first);
+            for (unsigned Id : P.second)
+                E = hash_combine(E, Id);
+            H += E;
+        }
+        return H;
     }
 
-    inline const_pointee_iterator pointee_begin(const PointsToNode *N) {
+    inline const_pointee_iterator pointee_begin(const PointsToNode *N) const {
         if (N->singlePointee())
             return const_pointee_iterator(N->getSinglePointee());
         else
-            return const_pointee_iterator(s.begin(), s.end(), N);
+            return const_pointee_iterator(getPointees(N).begin(), N->getTable());
     }
 
-    inline const_pointee_iterator pointee_end(const PointsToNode *N) {
+    inline const_pointee_iterator pointee_end(const PointsToNode *N) const {
         if (N->singlePointee())
             return const_pointee_iterator(nullptr);
         else
-            return const_pointee_iterator(s.end(), s.end(), N);
+            return const_pointee_iterator(emptyPointees.end(), N->getTable());
     }
 
-    inline const_restriction_iterator restriction_begin(const std::set<PointsToNode *>& S) {
-        return const_restriction_iterator(s.begin(), s.end(), S.begin(), S.end());
+    // Returns the IDs of the pointees of N. Nodes with a single pointee don't
+    // have an entry, so their pointee isn't included.
+    inline const PointeeSet &getPointees(const PointsToNode *N) const {
+        auto Entry = s.find(N->getId());
+        return Entry == s.end() ? emptyPointees : Entry->second;
     }
 
-    inline const_restriction_iterator restriction_end(const std::set<PointsToNode *>& S) {
-        return const_restriction_iterator(s.end(), s.end(), S.begin(), S.end());
+    inline const_node_restriction_iterator restriction_begin(const NodeSet& S) const {
+        return const_node_restriction_iterator(s, S.begin(), S.end());
     }
 
-    inline const_restriction_iterator restriction_begin(const LivenessSet &S) {
-        return const_restriction_iterator(s.begin(), s.end(), S.begin(), S.end());
+    inline const_node_restriction_iterator restriction_end(const NodeSet& S) const {
+        return const_node_restriction_iterator(s, S.end(), S.end());
     }
 
-    inline const_restriction_iterator restriction_end(const LivenessSet &S) {
-        return const_restriction_iterator(s.end(), s.end(), S.begin(), S.end());
+    inline const_restriction_iterator restriction_begin(const LivenessSet &S) const {
+        return const_restriction_iterator(s, S.begin(), S.end());
     }
 
-    inline const_restriction_iterator restriction_begin(const LivenessSet *S) {
-        return const_restriction_iterator(s.begin(), s.end(), S->begin(), S->end());
+    inline const_restriction_iterator restriction_end(const LivenessSet &S) const {
+        return const_restriction_iterator(s, S.end(), S.end());
     }
 
-    inline const_restriction_iterator restriction_end(const LivenessSet *S) {
-        return const_restriction_iterator(s.end(), s.end(), S->begin(), S->end());
+    inline const_restriction_iterator restriction_begin(const LivenessSet *S) const {
+        return const_restriction_iterator(s, S->begin(), S->end());
     }
 
-    inline const_iterator begin() {
-        return s.begin();
+    inline const_restriction_iterator restriction_end(const LivenessSet *S) const {
+        return const_restriction_iterator(s, S->end(), S->end());
     }
 
-    inline const_iterator end() {
-        return s.end();
+    inline const_iterator begin() const {
+        return const_iterator(s.begin(), s.end(), nodes);
+    }
+
+    inline const_iterator end() const {
+        return const_iterator(s.end(), s.end(), nodes);
     }
 
     inline bool empty() const {
         return s.empty();
     }
 
-    bool isSubset(PointsToRelation &R) {
-        for (auto P : R.s) {
-            if (P.first->isAlwaysSummaryNode())
+    bool isSubset(const PointsToRelation &R) const {
+        for (auto &P : R.s) {
+            if (R.nodes->getNode(P.first)->isAlwaysSummaryNode())
                 continue;
 
-            bool found = false;
-            for (auto Q : s) {
-                if (Q == P)
-                    found = true;
-            }
-            if (!found)
+            auto Q = s.find(P.first);
+            if (Q == s.end() || !Q->second.contains(P.second))
                 return false;
         }
         return true;
     }
 
-    inline void insertEverythingInto(LivenessSet &S) {
-        for (auto P : s) {
+    inline void insertEverythingInto(LivenessSet &S) const {
+        for (auto P : *this) {
             S.insert(P.first);
             S.insert(P.second);
         }
@@ -271,7 +339,11 @@ public:
 
     void dump() const;
 private:
+    static const PointeeSet emptyPointees;
     container s;
+    // The table of the IDs of the nodes, which is only known once a pair
+    // has been added.
+    const PointsToNodeTable *nodes = nullptr;
 };
 
 #endif
@@ -0,0 +1,129 @@
+#ifndef LFCPA_RESULTSCACHE_H
+#define LFCPA_RESULTSCACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "LivenessPointsTo.h"
+
+using namespace llvm;
+
+// The MD5 hash of the text of a module, which identifies the module that a
+// cache was written for.
+struct ModuleHash {
+    uint8_t Bytes[16];
+
+    bool operator==(const ModuleHash &H) const;
+};
+
+ModuleHash hashModule(const Module &M);
+
+// A node read from a cache. Nodes are identified by what they are based on and
+// the indices of the fields that lead to them, so that nodes which aren't in
+// the cache can be made for globals.
+struct CachedNode {
+    enum CachedNodeKind { CNK_Unknown, CNK_Init, CNK_Value, CNK_Global, CNK_NoAlias, CNK_Other };
+    // The base is a function and the number of a value in it, or a global,
+    // depending on the kind.
+    unsigned K, A, B;
+    SmallVector<uint64_t, 4> Path;
+    // The number of indices at the end of the path that are added by the
+    // last field.
+    unsigned Last;
+
+    typedef std::tuple<unsigned, unsigned, unsigned, SmallVector<uint64_t, 4>> Base;
+    // Returns the address of the node in the same form as
+    // PointsToNode::getAddress: the node that the last field indexes into
+    // and the indices, without trailing zeros.
+    std::pair<Base, SmallVector<uint64_t, 4>> getAddress() const;
+    bool isSubNodeOf(const CachedNode &N) const;
+};
+
+// Numbers the functions, globals and values of a module in the order in which
+// they appear, so that they can be identified in a cache.
+class ModuleNumbering {
+    public:
+        static const unsigned None = ~0U;
+
+        explicit ModuleNumbering(const Module &M);
+        unsigned getFunction(const Function *F) const;
+        const Function *getFunction(unsigned N) const;
+        unsigned getNumFunctions() const {
+            return functions.size();
+        }
+        // Global variables are numbered before functions.
+        unsigned getGlobal(const GlobalObject *G) const;
+        // Returns the number of an argument or instruction within its
+        // function, or None if it was created after the numbering or has
+        // been forgotten. Arguments are numbered before instructions.
+        unsigned getValue(const Value *V) const;
+        const Value *getValue(const Function *F, unsigned N) const;
+        unsigned getNumValues(const Function *F) const;
+        // Forgets a value that is being deleted, so that a value created at
+        // the same address isn't given its number.
+        void forget(const Value *V);
+    private:
+        std::vector<const Function *> functions;
+        DenseMap<const Function *, unsigned> functionNumbers;
+        DenseMap<const GlobalObject *, unsigned> globalNumbers;
+        DenseMap<const Value *, unsigned> valueNumbers;
+        DenseMap<const Function *, std::vector<const Value *>> values;
+};
+
+// Writes the results of the analysis of M for each value, joined over the
+// contexts, and the information at each instruction in every context, to Path.
+// The contexts are identified by their functions only, since queries join
+// the contexts of a function.
+// Returns false if the file can't be written.
+bool writeResultsCache(StringRef Path, Module &M, const ModuleHash &Hash, LivenessPointsTo &Analysis);
+
+// The results read from a cache. The file is mapped rather than read where
+// possible, and the results are read from it in place when they are queried.
+class ResultsCache {
+    public:
+        // Returns nullptr if the file doesn't exist, is malformed or was
+        // written for a different module.
+        static std::unique_ptr<ResultsCache> open(StringRef Path, const Module &M, const ModuleHash &Hash);
+
+        // Sets Result to the nodes that V may point to. An empty result means
+        // that it isn't known.
+        void getPointsToSet(const Value *V, SmallVectorImpl<CachedNode> &Result, bool &AllowMustAlias);
+
+        // Forgets a value that is being deleted.
+        void deleteValue(const Value *V);
+
+        unsigned getNumContexts() const;
+        const Function *getContextFunction(unsigned C) const;
+        // Sets the nodes that are live before I in the context, and the pairs
+        // of nodes that may point to each other after it. Returns false, with
+        // both empty, if they aren't known.
+        bool getFactsAt(unsigned C, const Instruction *I, SmallVectorImpl<CachedNode> &Lin, SmallVectorImpl<std::pair<CachedNode, CachedNode>> &Aout);
+
+        enum Section {
+            S_Paths, S_Nodes, S_Functions, S_Values, S_Pointees, S_Sets,
+            S_SetElements, S_Relations, S_RelationPairs, S_Contexts, S_Facts,
+            NumSections
+        };
+    private:
+        ResultsCache(std::unique_ptr<MemoryBuffer> Buffer, const Module &M);
+        bool isValid() const;
+        const support::ulittle32_t *getRecord(Section S, unsigned I) const;
+        bool readNode(unsigned I, CachedNode &N) const;
+
+        std::unique_ptr<MemoryBuffer> buffer;
+        ModuleNumbering numbering;
+        // The start and number of records of each section.
+        const char *sections[NumSections];
+        uint64_t counts[NumSections];
+};
+
+#endif
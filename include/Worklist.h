@@ -0,0 +1,110 @@
+#ifndef LFCPA_WORKLIST_H
+#define LFCPA_WORKLIST_H
+
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+
+using namespace llvm;
+
+enum WorklistStrategy {
+    // Visit the elements in the order of their addresses. This is the order
+    // that was originally used, but it varies from run to run.
+    WS_Hash,
+    // Visit the elements whose liveness may have changed in post-order, and
+    // then those whose points-to information may have changed in reverse
+    // post-order.
+    WS_Priority
+};
+
+// The elements that need to be visited by the solver. Liveness is propagated
+// backwards, so elements are pushed backwards when the liveness information
+// after them may have changed, and forwards when the points-to information
+// before them may have changed. Elements that aren't in the order given to the
+// constructor are never added.
+template <typename T>
+class Worklist {
+    public:
+        // Order should list the elements in reverse post-order.
+        Worklist(ArrayRef<const T *> Order, WorklistStrategy Strategy) : Strategy(Strategy), order(Order.begin(), Order.end()), forward(Order.size()), backward(Order.size()) {
+            for (unsigned i = 0; i < order.size(); i++)
+                positions.insert(std::make_pair(order[i], i));
+        }
+
+        inline void pushForward(const T *E) {
+            push(E, forward);
+        }
+
+        inline void pushBackward(const T *E) {
+            push(E, backward);
+        }
+
+        inline bool empty() const {
+            return Strategy == WS_Hash ? hashed.empty() : forward.none() && backward.none();
+        }
+
+        const T *pop() {
+            if (Strategy == WS_Hash) {
+                const T *E = *hashed.begin();
+                hashed.erase(E);
+                return E;
+            }
+
+            // Visiting an element updates both directions, so it is removed
+            // from both.
+            unsigned i;
+            if (backward.any())
+                i = order.size() - 1 - backward.find_first();
+            else
+                i = forward.find_first();
+            forward.reset(i);
+            backward.reset(order.size() - 1 - i);
+            return order[i];
+        }
+    private:
+        inline void push(const T *E, BitVector &Direction) {
+            auto Position = positions.find(E);
+            if (Position == positions.end())
+                return;
+
+            if (Strategy == WS_Hash)
+                hashed.insert(E);
+            else if (&Direction == &forward)
+                forward.set(Position->second);
+            else
+                backward.set(order.size() - 1 - Position->second);
+        }
+
+        WorklistStrategy Strategy;
+        std::vector<const T *> order;
+        DenseMap<const T *, unsigned> positions;
+        // The bits of backward are indexed by post-order position, so that
+        // find_first returns the first element in post-order.
+        BitVector forward, backward;
+        SmallPtrSet<const T *, 32> hashed;
+};
+
+// Returns the blocks of F in reverse post-order, followed by any blocks that
+// are unreachable from the entry block.
+inline SmallVector<const BasicBlock *, 32> getBlocksInReversePostOrder(const Function *F) {
+    SmallVector<const BasicBlock *, 32> Result;
+    SmallPtrSet<const BasicBlock *, 32> Seen;
+    ReversePostOrderTraversal<const Function *> RPOT(F);
+    for (const BasicBlock *BB : RPOT) {
+        Result.push_back(BB);
+        Seen.insert(BB);
+    }
+    for (const BasicBlock &BB : *F)
+        if (!Seen.count(&BB))
+            Result.push_back(&BB);
+    return Result;
+}
+
+#endif
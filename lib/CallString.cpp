@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
@@ -5,110 +11,272 @@
 
 #include "CallString.h"
 
+// The nodes of the trie, indexed by ID. Nodes are never removed, so IDs are
+// stable.
+std::vector<std::unique_ptr<CallString::Node>> &CallString::getNodes() {
+    static std::vector<std::unique_ptr<CallString::Node>> nodes;
+    return nodes;
+}
+
+// The trie is immutable apart from the addition of nodes, so the result of
+// matching two call strings never changes. The key is the IDs of the cyclic
+// string's two parts and of the non-cyclic string.
+static DenseMap<std::pair<std::pair<unsigned, unsigned>, unsigned>, bool> matchesCache;
+
+// Guards the parts of the trie that change after the nodes are created: the
+// list of nodes, the children and the caches. The rest of a node is
+// immutable, so it can be read without the lock.
+static std::mutex trieLock;
+
+std::atomic<const CallString::Node *> CallString::root{nullptr};
+
+const CallInst *CallString::Node::findLastCallInst(const Instruction *Call, const Node *Parent) {
+    if (Call != nullptr)
+        if (const CallInst *CI = dyn_cast<CallInst>(Call))
+            return CI;
+    return Parent == nullptr ? nullptr : Parent->LastCallInst;
+}
+
+const CallString::Node *CallString::Node::findJump(const Node *Parent) {
+    if (Parent == nullptr)
+        return nullptr;
+    const Node *J = Parent->jump;
+    if (J != nullptr && J->jump != nullptr && Parent->depth - J->depth == J->depth - J->jump->depth)
+        return J->jump;
+    return Parent;
+}
+
+CallString::Node::Node(const Instruction *Call, const Node *Parent)
+    : Call(Call),
+      Parent(Parent),
+      depth(Parent == nullptr ? 0 : Parent->depth + 1),
+      id(getNodes().size()),
+      LastCallInst(findLastCallInst(Call, Parent)),
+      jump(findJump(Parent)) {
+    // The root's jump pointer points to itself.
+    if (jump == nullptr)
+        jump = this;
+
+    if (Parent == nullptr) {
+        belowSummary = false;
+        return;
+    }
+    callsIn = Parent->callsIn;
+    belowSummary = Parent->belowSummary || Call == nullptr;
+    if (const CallInst *CI = dyn_cast_or_null<CallInst>(Call)) {
+        const Function *F = CI->getParent()->getParent();
+        auto I = std::lower_bound(callsIn.begin(), callsIn.end(), std::make_pair(F, 0u));
+        if (I == callsIn.end() || I->first != F)
+            callsIn.insert(I, std::make_pair(F, 1u));
+        else if (I->second < 2)
+            I->second++;
+    }
+}
+
+const CallString::Node *CallString::Node::getAncestor(unsigned Depth) const {
+    assert(Depth <= depth && "The ancestor must not be deeper than the node.");
+    const Node *N = this;
+    while (N->depth > Depth) {
+        if (N->jump->depth >= Depth)
+            N = N->jump;
+        else
+            N = N->Parent;
+    }
+    return N;
+}
+
+const CallString::Node *CallString::getRoot() {
+    if (const Node *Root = root.load(std::memory_order_acquire))
+        return Root;
+    std::lock_guard<std::mutex> Guard(trieLock);
+    std::vector<std::unique_ptr<Node>> &nodes = getNodes();
+    if (nodes.empty()) {
+        nodes.emplace_back(new Node(nullptr, nullptr));
+        root.store(nodes.front().get(), std::memory_order_release);
+    }
+    return nodes.front().get();
+}
+
+const CallString::Node *CallString::getChild(const Node *Parent, const Instruction *I) {
+    std::lock_guard<std::mutex> Guard(trieLock);
+    auto Existing = Parent->children.find(I);
+    if (Existing != Parent->children.end())
+        return Existing->second;
+
+    std::vector<std::unique_ptr<Node>> &nodes = getNodes();
+    nodes.emplace_back(new Node(I, Parent));
+    Node *Child = nodes.back().get();
+    Parent->children.insert(std::make_pair(I, Child));
+    return Child;
+}
+
+void CallString::clear() {
+    // Instructions may be reallocated at the same addresses once a module is
+    // destroyed, so the trie can't be kept across modules.
+    std::lock_guard<std::mutex> Guard(trieLock);
+    matchesCache.clear();
+    root.store(nullptr, std::memory_order_release);
+    getNodes().clear();
+}
+
+void CallString::forgetCallSites(const SmallPtrSetImpl<const Instruction *> &Calls) {
+    std::lock_guard<std::mutex> Guard(trieLock);
+    for (auto &N : getNodes()) {
+        SmallVector<const Instruction *, 4> forgotten;
+        for (auto &C : N->children)
+            if (Calls.count(C.first))
+                forgotten.push_back(C.first);
+        for (const Instruction *I : forgotten)
+            N->children.erase(I);
+    }
+}
+
 CallString CallString::empty() {
-    return CallString();
+    return CallString(getRoot(), getRoot());
 }
 
 CallString CallString::addCallSite(const Instruction *I) const {
-    CallString result = *this;
-    result.nonCyclic.push_back(I);
-    return result;
+    if (isSummary())
+        return *this;
+    return CallString(getChild(nonCyclic, I), cyclic);
+}
+
+CallString CallString::getSummary() const {
+    assert(!isCyclic() && "Only non-cyclic call strings can be summarised.");
+    if (isSummary())
+        return *this;
+    return CallString(getChild(nonCyclic, nullptr), cyclic);
 }
 
 bool CallString::isNonCyclicPrefix(const CallString &S) const {
-    auto thisIter = nonCyclic.begin();
-    auto thisEnd = nonCyclic.end();
-    for (auto &I : S.nonCyclic) {
-        if (thisIter == thisEnd) {
-            // S is longer!
-            return false;
-        }
-        else if (I != *thisIter) {
-            // S contains a different element.
-            return false;
-        }
-        else
-            thisIter++;
-    }
-    return thisIter != thisEnd;
+    // S must be strictly shorter than this call string.
+    if (S.nonCyclic->depth >= nonCyclic->depth)
+        return false;
+    return nonCyclic->getAncestor(S.nonCyclic->depth) == S.nonCyclic;
 }
 
 CallString CallString::createCyclicFromPrefix(const CallString &S) const {
-    auto thisIter = nonCyclic.begin();
-    auto thisEnd = nonCyclic.end();
-    for (auto &I : S.nonCyclic) {
-        thisIter++;
-        // Supress unused variable warning in non-asserts builds.
-        (void)I;
-    }
+    assert(isNonCyclicPrefix(S));
 
-    CallString result = S;
-    result.cyclic = SmallVector<const Instruction *, 8>(thisIter, thisEnd);
-    return result;
+    // Collect the calls after the prefix and add them to the trie in order.
+    SmallVector<const Instruction *, 8> suffix;
+    for (const Node *N = nonCyclic; N != S.nonCyclic; N = N->Parent)
+        suffix.push_back(N->Call);
+
+    const Node *C = getRoot();
+    for (auto I = suffix.rbegin(), E = suffix.rend(); I != E; ++I)
+        C = getChild(C, *I);
+
+    return CallString(S.nonCyclic, C);
 }
 
 bool CallString::matches(const CallString &S) const {
+    assert(!S.isCyclic() && "Only non-cyclic call strings can be matched.");
 
-    auto iter = S.nonCyclic.begin();
-    auto end = S.nonCyclic.end();
-    for (auto &I : nonCyclic) {
-        if (iter == end) {
-            // S isn't long enough!
-            return false;
-        }
-        else if (I != *iter) {
-            // S contains a different element.
-            return false;
-        }
-        else
-            iter++;
-    }
+    if (!isCyclic())
+        return nonCyclic == S.nonCyclic;
 
-    if (isCyclic()) {
-        while (iter != end) {
-            for (auto &I : cyclic) {
-                if (iter == end) {
-                    // S has an incomplete cyclic part at the end.
-                    return false;
-                }
-                else if (I != *iter) {
-                    // S contains a different element.
-                    return false;
-                }
-                else
-                    iter++;
+    unsigned prefixLength = nonCyclic->depth, cycleLength = cyclic->depth;
+    if (S.nonCyclic->depth < prefixLength || (S.nonCyclic->depth - prefixLength) % cycleLength != 0)
+        return false;
+
+    auto Key = std::make_pair(getKey(), S.nonCyclic->id);
+    std::lock_guard<std::mutex> Guard(trieLock);
+    auto Cached = matchesCache.find(Key);
+    if (Cached != matchesCache.end())
+        return Cached->second;
+
+    // Compare S against the cyclic part, one repetition at a time starting at
+    // the end, then check that what remains is the non-cyclic part.
+    bool result = true;
+    const Node *N = S.nonCyclic;
+    while (result && N->depth > prefixLength) {
+        for (const Node *C = cyclic; !C->isRoot(); C = C->Parent, N = N->Parent) {
+            if (C->Call != N->Call) {
+                result = false;
+                break;
             }
         }
+    }
+    result = result && N == nonCyclic;
+
+    matchesCache.insert(std::make_pair(Key, result));
+    return result;
+}
+
+SmallVector<const Instruction *, 8> CallString::getCallSites(bool Cyclic) const {
+    SmallVector<const Instruction *, 8> calls;
+    for (const Node *N = Cyclic ? cyclic : nonCyclic; !N->isRoot(); N = N->Parent)
+        if (N->Call != nullptr)
+            calls.push_back(N->Call);
+    std::reverse(calls.begin(), calls.end());
+    return calls;
+}
 
-        return true;
+bool CallString::containsCallSiteIn(const SmallPtrSetImpl<const Instruction *> &Calls) const {
+    for (const Node *N = nonCyclic; !N->isRoot(); N = N->Parent)
+        if (Calls.count(N->Call))
+            return true;
+    for (const Node *N = cyclic; !N->isRoot(); N = N->Parent)
+        if (Calls.count(N->Call))
+            return true;
+    return false;
+}
+
+bool CallString::hasNonCyclicPrefixIn(const DenseSet<std::pair<unsigned, unsigned>> &Keys) const {
+    unsigned rootId = getRoot()->id;
+    for (const Node *N = nonCyclic; N != nullptr; N = N->Parent)
+        if (Keys.count(std::make_pair(N->id, rootId)))
+            return true;
+    return false;
+}
+
+CallString::Profile CallString::getProfile() const {
+    assert(!isCyclic() && !isSummary() && "Only non-cyclic call strings have profiles.");
+
+    DenseMap<const Function *, unsigned> counts;
+    for (const Node *N = nonCyclic; !N->isRoot(); N = N->Parent) {
+        if (const CallInst *CI = dyn_cast<CallInst>(N->Call)) {
+            unsigned &count = counts[CI->getParent()->getParent()];
+            if (count < 2)
+                count++;
+        }
     }
-    else
-        return iter == end;
+
+    std::vector<std::pair<const Function *, unsigned>> sorted(counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end());
+    const CallInst *Last = nonCyclic->LastCallInst;
+    return std::make_tuple(isEmpty(), Last != nullptr, Last == nullptr ? nullptr : Last->getCalledFunction(), sorted);
 }
 
-void CallString::dump() const {
-    bool first = true;
-    for (auto &I : nonCyclic) {
+void CallString::Node::dumpPath(bool &first) const {
+    SmallVector<const Instruction *, 8> calls;
+    for (const Node *N = this; !N->isRoot(); N = N->Parent)
+        calls.push_back(N->Call);
+
+    for (auto I = calls.rbegin(), E = calls.rend(); I != E; ++I) {
         if (!first)
             errs() << ", ";
-        I->print(errs());
+        if (*I == nullptr)
+            errs() << "...";
+        else
+            (*I)->print(errs());
         first = false;
     }
+}
+
+void CallString::dump() const {
+    bool first = true;
+    nonCyclic->dumpPath(first);
 
     if (isCyclic()) {
         if (!first)
             errs() << ", ";
         errs() << "[";
         first = true;
-        for (auto &I : cyclic) {
-            if (!first)
-                errs() << ", ";
-            I->print(errs());
-            first = false;
-        }
+        cyclic->dumpPath(first);
         errs() << "]*";
     }
 
     errs() << "\n";
 }
-
@@ -0,0 +1,41 @@
+#include <algorithm>
+
+#include "llvm/IR/Instructions.h"
+
+#include "FunctionFingerprint.h"
+
+FunctionFingerprint computeFingerprint(const Function &F) {
+    FunctionFingerprint Result;
+    Result.HasIndirectCalls = false;
+    hash_code Hash = hash_combine(&F, F.getFunctionType());
+
+    for (const Argument &A : F.args()) {
+        Hash = hash_combine(Hash, &A);
+        Result.Values.push_back(&A);
+    }
+
+    for (const BasicBlock &BB : F) {
+        Hash = hash_combine(Hash, &BB);
+        for (const Instruction &I : BB) {
+            // Operands are uniqued or are instructions, arguments and blocks
+            // of this function, so they are identified by address as well.
+            Hash = hash_combine(Hash, &I, I.getOpcode(), I.getType());
+            for (const Use &U : I.operands())
+                Hash = hash_combine(Hash, U.get());
+            Result.Values.push_back(&I);
+
+            if (const CallInst *CI = dyn_cast<CallInst>(&I)) {
+                Result.CallSites.push_back(CI);
+                if (const Function *Callee = CI->getCalledFunction())
+                    Result.Callees.push_back(Callee);
+                else
+                    Result.HasIndirectCalls = true;
+            }
+        }
+    }
+
+    std::sort(Result.Callees.begin(), Result.Callees.end());
+    Result.Callees.erase(std::unique(Result.Callees.begin(), Result.Callees.end()), Result.Callees.end());
+    Result.Hash = hash_combine(Hash, Result.HasIndirectCalls, hash_combine_range(Result.Callees.begin(), Result.Callees.end()));
+    return Result;
+}
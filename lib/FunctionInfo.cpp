@@ -0,0 +1,23 @@
+#include "llvm/IR/InstIterator.h"
+
+#include "FunctionInfo.h"
+#include "Worklist.h"
+
+FunctionInfo::FunctionInfo(const Function *F, PointsToNodeFactory &Factory)
+    : First(&*inst_begin(F)),
+      Blocks(getBlocksInReversePostOrder(F)) {
+    for (const Argument &A : F->args())
+        Arguments.insert(Factory.getNode(&A));
+
+    for (const_inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+        if (const CallInst *CI = dyn_cast<CallInst>(&*I))
+            Calls.push_back(CI);
+        else if (const StoreInst *SI = dyn_cast<StoreInst>(&*I))
+            Stores.push_back(SI);
+        else if (const ReturnInst *RI = dyn_cast<ReturnInst>(&*I)) {
+            Returns.push_back(RI);
+            if (RI->getReturnValue() != nullptr)
+                ReturnValues.insert(Factory.getNode(RI->getReturnValue()));
+        }
+    }
+}
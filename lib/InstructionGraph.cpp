@@ -0,0 +1,68 @@
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Instructions.h"
+
+#include "InstructionGraph.h"
+#include "LivenessPointsToMisc.h"
+#include "Worklist.h"
+
+static bool containsPointer(const Type *T) {
+    if (T->isPointerTy())
+        return true;
+    if (const StructType *ST = dyn_cast<StructType>(T)) {
+        for (const Type *E : ST->elements())
+            if (containsPointer(E))
+                return true;
+        return false;
+    }
+    if (const ArrayType *AT = dyn_cast<ArrayType>(T))
+        return containsPointer(AT->getElementType());
+    if (const VectorType *VT = dyn_cast<VectorType>(T))
+        return containsPointer(VT->getElementType());
+    return false;
+}
+
+// Returns true if I may change liveness or points-to information. Calls are
+// analysed separately and may change anything. Any other instruction that
+// doesn't have a pointer among its operands or its result doesn't kill or ref
+// anything that can be live, so its Lin is its Lout and its Aout is its Ain.
+static bool isPointerRelevant(const Instruction *I) {
+    if (isa<CallInst>(I) || containsPointer(I->getType()))
+        return true;
+    for (const Use &U : I->operands())
+        if (containsPointer(U->getType()))
+            return true;
+    return false;
+}
+
+InstructionGraph::InstructionGraph(const Function *F) {
+    for (const BasicBlock *BB : getBlocksInReversePostOrder(F)) {
+        unsigned begin = order.size();
+        for (const Instruction &I : *BB) {
+            if (isBlockBoundary(&I) || isPointerRelevant(&I)) {
+                positions.insert(std::make_pair(&I, order.size()));
+                order.push_back(&I);
+            }
+        }
+        blocks.insert(std::make_pair(BB, std::make_pair(begin, (unsigned)order.size())));
+    }
+}
+
+ArrayRef<const Instruction *> InstructionGraph::getInstructions(const BasicBlock *BB) const {
+    auto Range = blocks.find(BB);
+    assert(Range != blocks.end());
+    return ArrayRef<const Instruction *>(order).slice(Range->second.first, Range->second.second - Range->second.first);
+}
+
+const Instruction *InstructionGraph::getNext(const Instruction *I) const {
+    // The terminator of the block is never skipped, so the next instruction
+    // in the order is in the same block.
+    auto Position = positions.find(I);
+    assert(Position != positions.end() && !isa<TerminatorInst>(I));
+    return order[Position->second + 1];
+}
+
+const Instruction *InstructionGraph::getPrevious(const Instruction *I) const {
+    auto Position = positions.find(I);
+    assert(Position != positions.end() && I != &I->getParent()->front());
+    return order[Position->second - 1];
+}
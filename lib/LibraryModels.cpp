@@ -0,0 +1,146 @@
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "LibraryModels.h"
+
+static cl::opt<std::string> LibraryModelsFile("lfcpa-library-models",
+    cl::desc("A file of models of library functions, which extend or "
+             "replace the built-in models"),
+    cl::value_desc("filename"));
+
+// The built-in models, in the format of the spec file. Functions that aren't
+// listed here are assumed to be able to change anything reachable from their
+// arguments.
+static const char *const BuiltinModels =
+    "fprintf none\n"
+    "fflush none\n"
+    "fwrite none\n"
+    "fputc none\n"
+    "llvm.lifetime.start none\n"
+    "llvm.lifetime.end none\n"
+    "strcmp none\n"
+    "strlen none\n"
+    "printf none\n"
+    "exit none\n"
+    "putchar none\n"
+    "sprintf none\n"
+    "strtol none\n"
+    "puts none\n"
+    "strncmp none\n"
+    "_IO_putc none\n"
+    "fclose none\n"
+    "floor none\n"
+    "ceil none\n"
+    "free none\n"
+    "malloc alloc\n"
+    "calloc alloc\n"
+    // The result is either a new allocation holding the old contents or the
+    // old allocation itself.
+    "realloc alloc return 0\n"
+    "memcpy copy 1 0 return 0\n"
+    "memmove copy 1 0 return 0\n"
+    "strcpy copy 1 0 return 0\n"
+    "strncpy copy 1 0 return 0\n"
+    "strcat copy 1 0 return 0\n"
+    "strncat copy 1 0 return 0\n"
+    "llvm.memcpy.p0i8.p0i8.i32 copy 1 0\n"
+    "llvm.memcpy.p0i8.p0i8.i64 copy 1 0\n"
+    "llvm.memmove.p0i8.p0i8.i32 copy 1 0\n"
+    "llvm.memmove.p0i8.p0i8.i64 copy 1 0\n"
+    "strchr return 0\n"
+    "strrchr return 0\n"
+    "strstr return 0\n";
+
+bool LibraryModel::appliesTo(const CallInst *CI) const {
+    unsigned n = CI->getNumArgOperands();
+    for (unsigned A : ReturnedArguments)
+        if (A >= n)
+            return false;
+    for (auto &C : Copies)
+        if (C.first >= n || C.second >= n)
+            return false;
+    return true;
+}
+
+LibraryModels::LibraryModels() {
+    std::string Error;
+    bool valid = parse(BuiltinModels, Error);
+    assert(valid && "The built-in library models are malformed.");
+    (void)valid;
+
+    if (LibraryModelsFile.empty())
+        return;
+
+    auto Buffer = MemoryBuffer::getFile(LibraryModelsFile);
+    if (!Buffer)
+        report_fatal_error("Could not read library models from " + Twine(LibraryModelsFile) + ": " + Buffer.getError().message());
+    if (!parse((*Buffer)->getBuffer(), Error))
+        report_fatal_error(Twine(LibraryModelsFile) + ": " + Error);
+}
+
+const LibraryModels &LibraryModels::get() {
+    // Initialised once, even if several threads call this at the same time.
+    static LibraryModels Models;
+    return Models;
+}
+
+const LibraryModel *LibraryModels::lookup(const Function *F) const {
+    auto M = models.find(F->getName());
+    return M == models.end() ? nullptr : &M->second;
+}
+
+bool LibraryModels::parse(StringRef Spec, std::string &Error) {
+    unsigned lineNumber = 0;
+    while (!Spec.empty()) {
+        StringRef Line;
+        std::tie(Line, Spec) = Spec.split('\n');
+        lineNumber++;
+        Line = Line.split('#').first;
+
+        SmallVector<StringRef, 8> Tokens;
+        SplitString(Line, Tokens);
+        if (Tokens.empty())
+            continue;
+
+        auto fail = [&](const Twine &Message) -> bool {
+            Error = ("line " + Twine(lineNumber) + ": " + Message).str();
+            return false;
+        };
+        auto readArgument = [&](unsigned i, unsigned &A) {
+            return i < Tokens.size() && !Tokens[i].getAsInteger(10, A);
+        };
+
+        LibraryModel Model;
+        for (unsigned i = 1; i < Tokens.size(); i++) {
+            StringRef Effect = Tokens[i];
+            if (Effect == "none")
+                continue;
+            else if (Effect == "alloc")
+                Model.Allocates = true;
+            else if (Effect == "return") {
+                unsigned A;
+                if (!readArgument(++i, A))
+                    return fail("expected an argument number after 'return'");
+                Model.ReturnedArguments.push_back(A);
+            }
+            else if (Effect == "copy") {
+                unsigned From, To;
+                if (!readArgument(++i, From) || !readArgument(++i, To))
+                    return fail("expected two argument numbers after 'copy'");
+                Model.Copies.push_back(std::make_pair(From, To));
+            }
+            else
+                return fail("unknown effect '" + Effect + "'");
+        }
+        if (Tokens.size() == 1)
+            return fail("expected at least one effect for '" + Tokens[0] + "'");
+
+        models[Tokens[0]] = Model;
+    }
+
+    return true;
+}
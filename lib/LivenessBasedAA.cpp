@@ -1,33 +1,134 @@
 #include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/Passes.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 
 #include "LivenessPointsTo.h"
+#include "LivenessPointsToPass.h"
+#include "PointsToIndex.h"
+#include "ResultsCache.h"
 
 using namespace llvm;
 
+static cl::opt<std::string> CacheFile("lfcpa-cache",
+    cl::desc("A file in which the results are kept between runs. If it "
+             "holds the results for the module being analysed, alias queries "
+             "are answered from it instead of running the analysis"),
+    cl::value_desc("filename"));
+
+static cl::opt<bool> OnDemand("lfcpa-on-demand",
+    cl::desc("Only analyse the functions that can affect the values that "
+             "alias queries are made about, when the first query about them "
+             "is made"),
+    cl::init(false));
+
 namespace {
+// The nodes are either those of the analysis or those read from a cache.
+inline std::pair<const PointsToNode *, SmallVector<uint64_t, 4>> getAddress(PointsToNode *N) {
+    return N->getAddress();
+}
+
+inline bool isSubNodeOf(PointsToNode *N, PointsToNode *M) {
+    return N->isSubNodeOf(M);
+}
+
+inline std::pair<CachedNode::Base, SmallVector<uint64_t, 4>> getAddress(const CachedNode &N) {
+    return N.getAddress();
+}
+
+inline bool isSubNodeOf(const CachedNode &N, const CachedNode &M) {
+    return N.isSubNodeOf(M);
+}
+
 struct LivenessBasedAA : public ModulePass, public AliasAnalysis {
     static char ID;
 
-    LivenessPointsTo analysis;
+    // The analysis shared with the other passes that use it.
+    LivenessPointsTo *analysis = nullptr;
+    // The results read from the cache, if they were there.
+    std::unique_ptr<ResultsCache> cache;
+
+    // The pointees of each value that has been queried, and whether they can
+    // be the basis of a MustAlias or PartialAlias result.
+    template <typename Node>
+    struct Pointees {
+        SmallVector<Node, 4> Nodes;
+        bool AllowMustAlias;
+    };
+    DenseMap<const Value *, Pointees<PointsToNode *>> pointees;
+    DenseMap<const Value *, Pointees<CachedNode>> cachedPointees;
+    // The result of each query, keyed by the stripped pointers in address
+    // order, and the values that each value has been queried with, so that
+    // the results can be forgotten when a value is deleted.
+    DenseMap<std::pair<const Value *, const Value *>, AliasResult> results;
+    DenseMap<const Value *, SmallVector<const Value *, 4>> queriedWith;
+    // The results of the analysis of the instructions, once it has finished.
+    PointsToIndex index;
+    // The nodes that each call may access, as sorted IDs followed by those of
+    // the nodes that they are sub-nodes of, if they are known.
+    struct CallAccess {
+        bool Known;
+        SmallVector<unsigned, 8> Nodes, Ancestors;
+    };
+    DenseMap<const Value *, CallAccess> callAccesses;
+    // The same for the results read from the cache, with the contexts of
+    // each function in the cache and whether the accesses that each
+    // function makes are seen by the analysis.
+    struct CachedCallAccess {
+        bool Known;
+        SmallVector<CachedNode, 8> Nodes;
+    };
+    DenseMap<const Value *, CachedCallAccess> cachedCallAccesses;
+    DenseMap<const Function *, SmallVector<unsigned, 4>> cachedContexts;
+    DenseMap<const Function *, bool> visibleAccesses;
 
     LivenessBasedAA() : ModulePass(ID) {}
 
     bool runOnModule(Module &M) override {
         InitializeAliasAnalysis(this, &M.getDataLayout());
-        analysis.runOnModule(M);
+        ModuleHash Hash;
+        if (!CacheFile.empty()) {
+            Hash = hashModule(M);
+            cache = ResultsCache::open(CacheFile, M, Hash);
+            if (cache) {
+                for (unsigned C = 0, E = cache->getNumContexts(); C != E; ++C)
+                    if (const Function *F = cache->getContextFunction(C))
+                        cachedContexts[F].push_back(C);
+                return false;
+            }
+        }
+
+        LivenessPointsToPass &Pass = getAnalysis<LivenessPointsToPass>();
+        if (OnDemand) {
+            // Only complete results are written to the cache.
+            analysis = &Pass.getResultOnDemand();
+            return false;
+        }
+
+        analysis = &Pass.getResult();
+        if (!CacheFile.empty() && !writeResultsCache(CacheFile, M, Hash, *analysis))
+            errs() << "warning: could not write the results to " << CacheFile << "\n";
+
+        // The results are final, so queries are answered from a flat index
+        // of them. The solver's scratch state isn't needed any more unless
+        // the analysis is kept to be updated incrementally.
+        index.build(M, *analysis);
+        if (!LivenessPointsTo::isIncremental())
+            analysis->releaseScratch();
         return false;
     }
 
-    bool areAllSubNodes(const std::set<PointsToNode *> A, const std::set<PointsToNode *> B) {
-        for (auto N : A)
-            for (auto M : B)
-                if (!N->isSubNodeOf(M))
+    template <typename NodeSet>
+    bool areAllSubNodes(const NodeSet &A, const NodeSet &B) {
+        for (auto &N : A)
+            for (auto &M : B)
+                if (!isSubNodeOf(N, M))
                     return false;
         return true;
     }
@@ -53,20 +154,77 @@ struct LivenessBasedAA : public ModulePass, public AliasAnalysis {
             return NoAlias;
         }
 
-        bool allowMustAlias = true;
-        std::set<PointsToNode *> ASet = analysis.getPointsToSet(A, allowMustAlias);
-        std::set<PointsToNode *> BSet = analysis.getPointsToSet(B, allowMustAlias);
+        // The result doesn't depend on the order of the values.
+        auto Key = A < B ? std::make_pair(A, B) : std::make_pair(B, A);
+        auto Cached = results.find(Key);
+        if (Cached != results.end())
+            return Cached->second;
 
+        PointsToIndex::Entry EA, EB;
+        AliasResult result = cache ? getResultFromPointees(cachedPointees, A, B)
+            : index.lookup(A, EA) && index.lookup(B, EB) ? getResult(EA, EB)
+            : getResultFromPointees(pointees, A, B);
+        results.insert(std::make_pair(Key, result));
+        queriedWith[A].push_back(B);
+        queriedWith[B].push_back(A);
+        return result;
+    }
+
+    AliasResult getResult(const PointsToIndex::Entry &EA, const PointsToIndex::Entry &EB) {
+        if (EA.Pointees.empty() || EB.Pointees.empty())
+            return MayAlias;
+
+        // MustAlias and PartialAlias depend on the addresses of the nodes,
+        // so those results are found from the nodes themselves.
+        if (EA.AllowMustAlias && EB.AllowMustAlias) {
+            SmallVector<PointsToNode *, 4> ASet, BSet;
+            for (unsigned Id : EA.Pointees)
+                ASet.push_back(analysis->getNodeWithId(Id));
+            for (unsigned Id : EB.Pointees)
+                BSet.push_back(analysis->getNodeWithId(Id));
+            return getResult(ASet, BSet, true);
+        }
+
+        if (PointsToIndex::intersects(EA.Pointees, EB.Ancestors) || PointsToIndex::intersects(EA.Ancestors, EB.Pointees))
+            return MayAlias;
+        return NoAlias;
+    }
+
+    void findPointees(const Value *V, Pointees<PointsToNode *> &P) {
+        analysis->getPointsToSet(V, P.Nodes, P.AllowMustAlias);
+    }
+
+    void findPointees(const Value *V, Pointees<CachedNode> &P) {
+        cache->getPointsToSet(V, P.Nodes, P.AllowMustAlias);
+    }
+
+    template <typename Node>
+    AliasResult getResultFromPointees(DenseMap<const Value *, Pointees<Node>> &Known, const Value *A, const Value *B) {
+        // Both values are looked up after they have been added, since adding
+        // one may move the other.
+        for (const Value *V : {A, B}) {
+            if (!Known.count(V)) {
+                Pointees<Node> &P = Known[V];
+                P.AllowMustAlias = true;
+                findPointees(V, P);
+            }
+        }
+        const Pointees<Node> &PA = Known.find(A)->second, &PB = Known.find(B)->second;
+        return getResult(PA.Nodes, PB.Nodes, PA.AllowMustAlias && PB.AllowMustAlias);
+    }
+
+    template <typename NodeSet>
+    AliasResult getResult(const NodeSet &ASet, const NodeSet &BSet, bool allowMustAlias) {
         // If either of the sets are empty, then we don't know what one of the
         // values can point to, and therefore we don't know if they can alias.
         if (ASet.empty() || BSet.empty())
             return MayAlias;
 
-        std::pair<const PointsToNode *, SmallVector<uint64_t, 4>> address;
+        decltype(getAddress(*ASet.begin())) address;
         bool possibleMustAlias = allowMustAlias, foundAddress = false;
-        for (PointsToNode *N : ASet) {
+        for (auto &N : ASet) {
             if (possibleMustAlias) {
-                auto currentAddress = N->getAddress();
+                auto currentAddress = getAddress(N);
                 if (foundAddress && address != currentAddress)
                     possibleMustAlias = false;
                 else if (!foundAddress) {
@@ -75,9 +233,9 @@ struct LivenessBasedAA : public ModulePass, public AliasAnalysis {
                 }
             }
         }
-        for (PointsToNode *N : BSet) {
+        for (auto &N : BSet) {
             if (possibleMustAlias) {
-                auto currentAddress = N->getAddress();
+                auto currentAddress = getAddress(N);
                 // ASet contains at least one element.
                 assert(foundAddress);
                 if (address != currentAddress)
@@ -100,9 +258,9 @@ struct LivenessBasedAA : public ModulePass, public AliasAnalysis {
                 return PartialAlias;
         }
 
-        for (PointsToNode *N : ASet)
-            for (PointsToNode *M : BSet)
-                if (M->isSubNodeOf(N) || N->isSubNodeOf(M))
+        for (auto &N : ASet)
+            for (auto &M : BSet)
+                if (isSubNodeOf(M, N) || isSubNodeOf(N, M))
                     return MayAlias;
 
         // If the values do not share any pointees then they cannot alias.
@@ -116,8 +274,210 @@ struct LivenessBasedAA : public ModulePass, public AliasAnalysis {
         return result == MayAlias ? AliasAnalysis::alias(LocA, LocB) : result;
     }
 
+    ModRefResult getModRefInfo(ImmutableCallSite CS, const MemoryLocation &Loc) override {
+        if (cannotAccess(CS, Loc))
+            return NoModRef;
+        return AliasAnalysis::getModRefInfo(CS, Loc);
+    }
+
+    // Returns true if the call can't read or write the location. Only the
+    // locations in stack and noalias objects are considered, since the call
+    // may name globals directly.
+    bool cannotAccess(ImmutableCallSite CS, const MemoryLocation &Loc) {
+        const CallInst *CI = dyn_cast<CallInst>(CS.getInstruction());
+        if (CI == nullptr)
+            return false;
+
+        const Value *P = Loc.Ptr->stripPointerCasts();
+        if (cache)
+            return cannotAccessCached(CI, P);
+
+        PointsToIndex::Entry E;
+        SmallVector<unsigned, 8> PointeeIds, AncestorIds;
+        if (!index.lookup(P, E)) {
+            PointsToIndex::collectIds(lookupPointees(pointees, P).Nodes, PointeeIds, AncestorIds);
+            E.Pointees = PointeeIds;
+            E.Ancestors = AncestorIds;
+        }
+        if (E.Pointees.empty())
+            return false;
+        for (unsigned Id : E.Ancestors) {
+            PointsToNode *N = analysis->getNodeWithId(Id);
+            if (!isa<GEPPointsToNode>(N) && !isa<NoAliasPointsToNode>(N))
+                return false;
+        }
+
+        const CallAccess &Access = getCallAccess(CI);
+        return Access.Known && !PointsToIndex::intersects(E.Ancestors, Access.Nodes) && !PointsToIndex::intersects(E.Pointees, Access.Ancestors);
+    }
+
+    const CallAccess &getCallAccess(const CallInst *CI) {
+        auto Cached = callAccesses.find(CI);
+        if (Cached != callAccesses.end())
+            return Cached->second;
+
+        CallAccess &Access = callAccesses[CI];
+        SmallVector<PointsToNode *, 16> Nodes;
+        Access.Known = analysis->getAccessibleNodes(CI, Nodes);
+        if (Access.Known)
+            PointsToIndex::collectIds(Nodes, Access.Nodes, Access.Ancestors);
+        return Access;
+    }
+
+    bool cannotAccessCached(const CallInst *CI, const Value *P) {
+        const Pointees<CachedNode> &PP = lookupPointees(cachedPointees, P);
+        if (PP.Nodes.empty())
+            return false;
+        for (const CachedNode &N : PP.Nodes)
+            if (N.K != CachedNode::CNK_NoAlias)
+                return false;
+
+        const CachedCallAccess &Access = getCachedCallAccess(CI);
+        if (!Access.Known)
+            return false;
+        for (const CachedNode &N : PP.Nodes)
+            for (const CachedNode &A : Access.Nodes)
+                if (N.isSubNodeOf(A) || A.isSubNodeOf(N))
+                    return false;
+        return true;
+    }
+
+    const CachedCallAccess &getCachedCallAccess(const CallInst *CI) {
+        auto Cached = cachedCallAccesses.find(CI);
+        if (Cached != cachedCallAccesses.end())
+            return Cached->second;
+
+        CachedCallAccess &Access = cachedCallAccesses[CI];
+        Access.Known = findCachedAccessibleNodes(CI, Access.Nodes);
+        if (!Access.Known)
+            Access.Nodes.clear();
+        return Access;
+    }
+
+    // Finds the nodes that the call may access from the facts in the cache,
+    // as LivenessPointsTo::getAccessibleNodes does from the analysis.
+    bool findCachedAccessibleNodes(const CallInst *CI, SmallVectorImpl<CachedNode> &Result) {
+        if (!LivenessPointsTo::hasVisibleAccesses(CI, visibleAccesses))
+            return false;
+
+        const BasicBlock *BB = CI->getParent();
+        const Function *F = BB->getParent();
+        auto Contexts = cachedContexts.find(F);
+        if (Contexts == cachedContexts.end())
+            return false;
+
+        // The relation before the call is the join of those after the
+        // instructions that precede it. The relation at the entry of a
+        // function isn't kept.
+        SmallVector<const Instruction *, 2> Preceding;
+        if (CI != &BB->front())
+            Preceding.push_back(CI->getPrevNode());
+        else if (BB == &F->getEntryBlock())
+            return false;
+        else
+            for (const_pred_iterator PI = pred_begin(BB), E = pred_end(BB); PI != E; ++PI)
+                Preceding.push_back((*PI)->getTerminator());
+
+        // The arguments aren't in the relations if they have a single
+        // pointee, so what they point to is found from their definitions.
+        SmallVector<CachedNode, 8> Arguments;
+        for (Value *V : CI->arg_operands()) {
+            if (!V->getType()->isPointerTy())
+                continue;
+            Pointees<CachedNode> PV = lookupPointees(cachedPointees, V);
+            if (PV.Nodes.empty())
+                return false;
+            Arguments.append(PV.Nodes.begin(), PV.Nodes.end());
+        }
+
+        auto Same = [](const CachedNode &A, const CachedNode &B) {
+            return A.isSubNodeOf(B) && B.isSubNodeOf(A);
+        };
+        auto AddAccessible = [&](const CachedNode &N) {
+            for (const CachedNode &M : Result)
+                if (Same(M, N))
+                    return false;
+            Result.push_back(N);
+            return true;
+        };
+
+        for (unsigned C : Contexts->second) {
+            SmallVector<CachedNode, 16> Lin, Unused;
+            SmallVector<std::pair<CachedNode, CachedNode>, 32> Pairs, Aout;
+            SmallVector<std::pair<CachedNode, CachedNode>, 1> UnusedPairs;
+            if (!cache->getFactsAt(C, CI, Lin, UnusedPairs))
+                return false;
+            for (const Instruction *I : Preceding) {
+                if (!cache->getFactsAt(C, I, Unused, Aout))
+                    return false;
+                Pairs.append(Aout.begin(), Aout.end());
+            }
+
+            // Each node that is reached is followed once per context; its
+            // pointees are those of it and of its fields.
+            SmallVector<CachedNode, 16> Pending(Lin.begin(), Lin.end()), Reached;
+            for (const CachedNode &N : Arguments) {
+                if (N.K == CachedNode::CNK_Unknown)
+                    return false;
+                AddAccessible(N);
+                Pending.push_back(N);
+            }
+            while (!Pending.empty()) {
+                CachedNode N = Pending.pop_back_val();
+                bool Seen = false;
+                for (const CachedNode &M : Reached)
+                    Seen = Seen || Same(M, N);
+                if (Seen)
+                    continue;
+                Reached.push_back(N);
+                for (auto &P : Pairs) {
+                    if (!P.first.isSubNodeOf(N))
+                        continue;
+                    if (P.second.K == CachedNode::CNK_Unknown)
+                        return false;
+                    AddAccessible(P.second);
+                    Pending.push_back(P.second);
+                }
+            }
+        }
+        return true;
+    }
+
+    template <typename Node>
+    const Pointees<Node> &lookupPointees(DenseMap<const Value *, Pointees<Node>> &Known, const Value *V) {
+        auto Existing = Known.find(V);
+        if (Existing != Known.end())
+            return Existing->second;
+        Pointees<Node> &P = Known[V];
+        P.AllowMustAlias = true;
+        findPointees(V, P);
+        return P;
+    }
+
+    void deleteValue(Value *V) override {
+        // Another value may be created at the same address, so everything
+        // that is known about V is forgotten.
+        pointees.erase(V);
+        cachedPointees.erase(V);
+        index.erase(V);
+        callAccesses.erase(V);
+        cachedCallAccesses.erase(V);
+        if (cache)
+            cache->deleteValue(V);
+        auto Partners = queriedWith.find(V);
+        if (Partners != queriedWith.end()) {
+            for (const Value *W : Partners->second)
+                results.erase(V < W ? std::make_pair((const Value *)V, W) : std::make_pair(W, (const Value *)V));
+            queriedWith.erase(Partners);
+        }
+        AliasAnalysis::deleteValue(V);
+    }
+
     void getAnalysisUsage(AnalysisUsage &AU) const override {
       AliasAnalysis::getAnalysisUsage(AU);
+      // Queries read the analysis after this pass has run, so it has to be
+      // kept for as long as this pass is.
+      AU.addRequiredTransitive<LivenessPointsToPass>();
       AU.setPreservesAll();
     }
 
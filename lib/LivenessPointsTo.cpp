@@ -1,81 +1,443 @@
+#include <algorithm>
 #include <set>
+#include <thread>
 
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "LibraryModels.h"
 #include "LivenessPointsToMisc.h"
 #include "LivenessPointsTo.h"
 #include "PointsToData.h"
 #include "PointsToNode.h"
+#include "Worklist.h"
 
 // Some statistics (LLVM_STATISTIC doesn't work out of tree)
-unsigned LivenessPointsTo::worklistIterations = 0;
-unsigned LivenessPointsTo::timesRanOnFunction = 0;
-
-bool createdSummaryNode = false;
+std::atomic<unsigned> LivenessPointsTo::worklistIterations(0);
+std::atomic<unsigned> LivenessPointsTo::timesRanOnFunction(0);
+
+unsigned LivenessPointsTo::instances = 0;
+
+static cl::opt<bool> BlockLevel("lfcpa-block-level",
+    cl::desc("Only keep the liveness and points-to information at the "
+             "boundaries of basic blocks, and recompute the information "
+             "inside blocks when it is needed"),
+    cl::init(false));
+
+static cl::opt<WorklistStrategy> WorklistOrder("lfcpa-worklist",
+    cl::desc("The order in which the solver visits instructions"),
+    cl::values(
+        clEnumValN(WS_Priority, "priority", "Post-order for liveness and reverse post-order for points-to information (default)"),
+        clEnumValN(WS_Hash, "hash", "The order of the instructions' addresses"),
+        clEnumValEnd),
+    cl::init(WS_Priority));
+
+static cl::opt<unsigned> Threads("lfcpa-threads",
+    cl::desc("The number of threads used to analyse the functions of a "
+             "module"),
+    cl::init(1));
+
+static cl::opt<bool> ValueContexts("lfcpa-value-contexts",
+    cl::desc("Reuse the results of a function at a fixed point for every "
+             "call string with the same boundary information"),
+    cl::init(false));
+
+static cl::opt<bool> AllRoots("lfcpa-all-roots",
+    cl::desc("Analyse every defined function from the empty call string, "
+             "instead of only the functions that can be called from outside "
+             "the module and aren't reached from inside it"),
+    cl::init(false));
+
+static cl::opt<bool> Incremental("lfcpa-incremental",
+    cl::desc("When a module is analysed again, keep the results of the "
+             "functions that haven't changed and don't call functions that "
+             "have, and only solve the contexts whose boundary information "
+             "has changed"),
+    cl::init(false));
+
+static cl::opt<unsigned> CallStringLimit("lfcpa-call-string-limit",
+    cl::desc("The maximum length of a call string. The contexts of longer "
+             "call strings are merged into one context for each function "
+             "below each call string at the limit (0 for no limit)"),
+    cl::init(0));
+
+// Set when a node becomes a summary node while a function is being solved.
+// Each thread solves its own functions, so the flag is per-thread.
+thread_local bool createdSummaryNode = false;
+// While the roots are analysed in parallel, the nodes that would become
+// summary nodes are collected here instead, so that no worker sees the
+// changes made by another in the middle of a round.
+thread_local SmallPtrSet<PointsToNode *, 8> *deferredSummaryNodes = nullptr;
 
 typedef SmallVector<APInt, 8> IndexList;
 
-std::set<PointsToNode *> LivenessPointsTo::getPointsToSet(const Value *V, bool &AllowMustAlias) {
-    if (const Instruction *I = dyn_cast<Instruction>(V)) {
-        PointsToNode *N = factory.getNode(I);
-        // If N is a summary node, the data may include pointees of fields.
-        if (N->isAlwaysSummaryNode() || !N->isFieldSensitive())
-            AllowMustAlias = false;
-        const BasicBlock *BB = I->getParent();
-        const Function *F = BB->getParent();
-        ProcedurePointsTo *P = data.getAtFunction(F);
-        for (auto p : *P) {
-            if (std::get<0>(p) == CallString::empty()) {
-                auto P = std::get<1>(p)->find(I);
-                if (P == std::get<1>(p)->end())
-                    return std::set<PointsToNode *>();
-                PointsToRelation *R = P->second.second;
-                std::set<PointsToNode *> s;
-                for (auto Pointee = R->pointee_begin(N), E = R->pointee_end(N); Pointee != E; ++Pointee)
-                    s.insert(*Pointee);
-                return s;
-            }
-        }
-    }
-    else if (const GlobalVariable *G = dyn_cast<GlobalVariable>(V)) {
-        std::set<PointsToNode *> s;
-        s.insert(factory.getGlobalNode(G));
-        return s;
+LivenessPointsTo::LivenessPointsTo() : mergedContexts(0), ownedFactory(new PointsToNodeFactory()), factory(*ownedFactory) {
+    instances++;
+}
+
+LivenessPointsTo::LivenessPointsTo(PointsToNodeFactory &Factory) : mergedContexts(0), factory(Factory) {
+    instances++;
+}
+
+LivenessPointsTo::~LivenessPointsTo() {
+    if (--instances == 0)
+        CallString::clear();
+}
+
+void LivenessPointsTo::releaseScratch() {
+    // Everything here is either rebuilt when it is needed or only speeds up
+    // the solver; the results themselves are kept.
+    callData.clear();
+    restrictions.clear();
+    valueContexts.clear();
+    summaryBoundaries.clear();
+    mergedCalls.clear();
+    calleeSummaries.clear();
+    indirectTargets.clear();
+    graphs.clear();
+    graphAllocator.DestroyAll();
+    infos.clear();
+    infoAllocator.DestroyAll();
+    clearLookupCaches();
+}
+
+PointsToNode *LivenessPointsTo::getNode(const Value *V) {
+    auto Cached = nodeCache.find(V);
+    if (Cached != nodeCache.end())
+        return Cached->second;
+    PointsToNode *N = factory.getNode(V);
+    nodeCache.insert(std::make_pair(V, N));
+    return N;
+}
+
+PointsToNode *LivenessPointsTo::getNoAliasNode(const Instruction *I) {
+    auto Cached = noAliasNodeCache.find(I);
+    if (Cached != noAliasNodeCache.end())
+        return Cached->second;
+    PointsToNode *N = isa<AllocaInst>(I) ? factory.getNoAliasNode(cast<AllocaInst>(I)) : factory.getNoAliasNode(cast<CallInst>(I));
+    noAliasNodeCache.insert(std::make_pair(I, N));
+    return N;
+}
+
+void LivenessPointsTo::clearLookupCaches() {
+    nodeCache.clear();
+    noAliasNodeCache.clear();
+    extendedCallStrings.clear();
+}
+
+void LivenessPointsTo::getPointsToSet(const Value *V, SmallVectorImpl<PointsToNode *> &Result, bool &AllowMustAlias) {
+    // If we can't determine what V can point to, the result is empty (i.e.
+    // "don't know").
+    Result.clear();
+    // The pointees of an instruction are those just after it, joined over
+    // every context of its function, since functions that are only called
+    // from the module have no context for the empty call string.
+    if (const Instruction *I = dyn_cast<Instruction>(V))
+        getPointsToSetAt(V, I, Result, AllowMustAlias);
+    else
+        getPointsToSetOfConstant(V, Result, AllowMustAlias);
+}
+
+// Sets Result to what V points to if it is a global or an address computed
+// from one, which is the same everywhere. Returns false otherwise.
+bool LivenessPointsTo::getPointsToSetOfConstant(const Value *V, SmallVectorImpl<PointsToNode *> &Result, bool &AllowMustAlias) {
+    if (isa<Instruction>(V))
+        return false;
+    if (const GlobalVariable *G = dyn_cast<GlobalVariable>(V)) {
+        Result.push_back(factory.getGlobalNode(G));
+        return true;
     }
-    else if (const GEPOperator *GEP = dyn_cast<GEPOperator>(V)) {
+    if (const GEPOperator *GEP = dyn_cast<GEPOperator>(V)) {
         if (GEP->hasAllConstantIndices()) {
             if (const GlobalVariable *Base = dyn_cast<GlobalVariable>(GEP->getPointerOperand())) {
-                std::set<PointsToNode *> s;
                 PointsToNode *Global = factory.getGlobalNode(Base);
-                s.insert(factory.getIndexedNode(Global, GEP));
-                return s;
+                Result.push_back(factory.getIndexedNode(Global, GEP));
             }
         }
         else {
-            std::set<PointsToNode *> s;
             // We represent non-constant GEPs by the node corresponding to the
             // pointer operand. Note that we cannot use this result as the basis
             // of a PartialAlias or MustAlias result.
-            s.insert(factory.getNode(GEP->getPointerOperand()));
+            Result.push_back(getNode(GEP->getPointerOperand()));
             AllowMustAlias = false;
-            return s;
         }
+        return true;
     }
+    return false;
+}
 
-    // If we can't determine what V can point to, return the empty set (i.e.
-    // "don't know").
-    return std::set<PointsToNode *>();
+// Returns the node of V, whose pointees are looked up at I, or nullptr if
+// they can't be.
+PointsToNode *LivenessPointsTo::getQueriedNode(const Value *V, const Instruction *I, bool &AllowMustAlias) {
+    const Function *F = I->getParent()->getParent();
+    if (const Instruction *VI = dyn_cast<Instruction>(V)) {
+        if (VI->getParent()->getParent() != F)
+            return nullptr;
+    }
+    else if (const Argument *A = dyn_cast<Argument>(V)) {
+        if (A->getParent() != F)
+            return nullptr;
+    }
+    else
+        return nullptr;
+
+    PointsToNode *N = getNode(V);
+    // If N is a summary node, the data may include pointees of fields.
+    if (N->isAlwaysSummaryNode() || !N->isFieldSensitive())
+        AllowMustAlias = false;
+    analyseReachingRoots(F);
+    return N;
+}
+
+// Returns the relation just after the nearest instruction at or before I in
+// its block that has a result in Out, or nullptr if there isn't one. Passes
+// that run after the analysis may add instructions, which have no results.
+static const PointsToRelation *findRelationAtOrBefore(const IntraproceduralPointsTo *Out, const Instruction *I) {
+    for (; I != nullptr; I = I->getPrevNode()) {
+        auto Found = Out->find(I);
+        if (Found != Out->end())
+            return Found->second.second;
+    }
+    return nullptr;
+}
+
+// Sets Relations to the relations whose join holds just before I in the
+// context E, or just after I if AfterI is set: the relations after the
+// instructions that precede it, or the relation at the entry of the function.
+// Returns false if they aren't known.
+bool LivenessPointsTo::getRelationsAt(const Instruction *I, bool AfterI, const ProcedurePointsTo::Entry &E, SmallVectorImpl<const PointsToRelation *> &Relations) {
+    IntraproceduralPointsTo *Out = std::get<1>(E);
+    if (!materializeResult(I->getParent()->getParent(), Out))
+        return false;
+
+    if (AfterI) {
+        auto Found = Out->find(I);
+        if (Found == Out->end())
+            return false;
+        Relations.push_back(Found->second.second);
+        return true;
+    }
+
+    const BasicBlock *BB = I->getParent();
+    if (I != &BB->front()) {
+        if (const PointsToRelation *R = findRelationAtOrBefore(Out, I->getPrevNode())) {
+            Relations.push_back(R);
+            return true;
+        }
+    }
+    if (BB == &BB->getParent()->getEntryBlock()) {
+        Relations.push_back(std::get<2>(E));
+        return true;
+    }
+    for (const_pred_iterator PI = pred_begin(BB), PE = pred_end(BB); PI != PE; ++PI) {
+        const PointsToRelation *R = findRelationAtOrBefore(Out, (*PI)->getTerminator());
+        if (R == nullptr)
+            return false;
+        Relations.push_back(R);
+    }
+    return true;
+}
+
+// Adds the pointees of N when I is reached in the context E, or just after I
+// if AfterI is set, to Result. Returns false if N has no pointees there, or
+// if they aren't known.
+bool LivenessPointsTo::addPointeesAt(PointsToNode *N, const Instruction *I, bool AfterI, const ProcedurePointsTo::Entry &E, SmallVectorImpl<PointsToNode *> &Result) {
+    SmallVector<const PointsToRelation *, 2> Relations;
+    if (!getRelationsAt(I, AfterI, E, Relations))
+        return false;
+
+    unsigned Size = Result.size();
+    for (const PointsToRelation *R : Relations)
+        for (auto Pointee = R->pointee_begin(N), PE = R->pointee_end(N); Pointee != PE; ++Pointee)
+            Result.push_back(*Pointee);
+    return Result.size() != Size;
+}
+
+static void removeDuplicatePointees(SmallVectorImpl<PointsToNode *> &Result) {
+    std::sort(Result.begin(), Result.end());
+    Result.erase(std::unique(Result.begin(), Result.end()), Result.end());
+}
+
+void LivenessPointsTo::getPointsToSetAt(const Value *V, const Instruction *I, const CallString &CS, SmallVectorImpl<PointsToNode *> &Result, bool &AllowMustAlias) {
+    Result.clear();
+    if (getPointsToSetOfConstant(V, Result, AllowMustAlias))
+        return;
+
+    PointsToNode *N = getQueriedNode(V, I, AllowMustAlias);
+    const Function *F = I->getParent()->getParent();
+    if (N == nullptr || !data.hasDataForFunction(F))
+        return;
+
+    ProcedurePointsTo *P = data.getAtFunction(F);
+    ProcedurePointsTo::Entry *E = P->find(CS);
+    if (E == nullptr)
+        E = P->findCyclicMatch(CS);
+    if (E != nullptr && addPointeesAt(N, I, V == I, *E, Result))
+        removeDuplicatePointees(Result);
+}
+
+void LivenessPointsTo::getPointsToSetAt(const Value *V, const Instruction *I, SmallVectorImpl<PointsToNode *> &Result, bool &AllowMustAlias) {
+    Result.clear();
+    if (getPointsToSetOfConstant(V, Result, AllowMustAlias))
+        return;
+
+    PointsToNode *N = getQueriedNode(V, I, AllowMustAlias);
+    const Function *F = I->getParent()->getParent();
+    if (N == nullptr || !data.hasDataForFunction(F))
+        return;
+
+    // If the pointees aren't known in one of the contexts, then they aren't
+    // known in the join.
+    for (const ProcedurePointsTo::Entry &E : *data.getAtFunction(F)) {
+        if (!addPointeesAt(N, I, V == I, E, Result)) {
+            Result.clear();
+            return;
+        }
+    }
+    removeDuplicatePointees(Result);
+}
+
+// Returns true if F doesn't access memory, or only marks the lifetime of
+// the memory that its argument points to.
+static bool onlyAccessesArguments(const Function *F) {
+    if (F->doesNotAccessMemory())
+        return true;
+    switch (F->getIntrinsicID()) {
+        case Intrinsic::lifetime_start:
+        case Intrinsic::lifetime_end:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void LivenessPointsTo::findVisibleAccesses(Module &M, DenseMap<const Function *, bool> &Visibility) {
+    // The functions in a cycle of calls are only visible if all of them are,
+    // so the call graph is visited an SCC at a time, callees first.
+    CallGraph CG(M);
+    for (scc_iterator<CallGraph *> I = scc_begin(&CG); !I.isAtEnd(); ++I) {
+        const std::vector<CallGraphNode *> &SCC = *I;
+        SmallPtrSet<const Function *, 4> Members;
+        for (CallGraphNode *N : SCC)
+            if (N->getFunction() != nullptr)
+                Members.insert(N->getFunction());
+
+        bool Visible = true;
+        for (const Function *F : Members) {
+            if (F->isDeclaration())
+                Visible = Visible && onlyAccessesArguments(F);
+            for (const_inst_iterator II = inst_begin(F), E = inst_end(F); Visible && II != E; ++II) {
+                if (isa<InvokeInst>(&*II))
+                    Visible = false;
+                else if (const CallInst *Call = dyn_cast<CallInst>(&*II)) {
+                    const Function *Called = Call->getCalledFunction();
+                    if (Called == nullptr)
+                        Visible = false;
+                    else if (Called->isDeclaration())
+                        Visible = onlyAccessesArguments(Called);
+                    else if (!Members.count(Called))
+                        Visible = Visibility.lookup(Called);
+                }
+            }
+        }
+
+        for (const Function *F : Members)
+            Visibility[F] = Visible;
+    }
+}
+
+bool LivenessPointsTo::hasVisibleAccesses(const CallInst *CI, DenseMap<const Function *, bool> &Visibility) {
+    const Function *Called = CI->getCalledFunction();
+    if (Called == nullptr)
+        return false;
+    if (Visibility.empty())
+        findVisibleAccesses(*const_cast<Module *>(Called->getParent()), Visibility);
+    return Visibility.lookup(Called);
+}
+
+bool LivenessPointsTo::getAccessibleNodes(const CallInst *CI, SmallVectorImpl<PointsToNode *> &Result) {
+    Result.clear();
+    // A function without a body only makes the nodes that its arguments
+    // point to live, so what it reaches beyond them isn't known.
+    if (!hasVisibleAccesses(CI, visibleAccesses))
+        return false;
+
+    const Function *F = CI->getParent()->getParent();
+    analyseReachingRoots(F);
+    if (!data.hasDataForFunction(F))
+        return false;
+
+    // Anything that the callee reads through a pointer is reached through a
+    // node that is live before the call, or through one of its arguments,
+    // so the nodes reachable from those are all that it can access. This is
+    // done in every context, since the call is analysed in each of them.
+    DenseSet<PointsToNode *> Seen;
+    SmallVector<PointsToNode *, 16> Pending;
+    for (const ProcedurePointsTo::Entry &E : *data.getAtFunction(F)) {
+        // A call added after the analysis ran has no results, so what it
+        // may access isn't known. The results are materialized by
+        // getRelationsAt, so the call is looked up after it.
+        SmallVector<const PointsToRelation *, 2> Relations;
+        if (!getRelationsAt(CI, false, E, Relations))
+            return false;
+        auto Live = std::get<1>(E)->find(CI);
+        if (Live == std::get<1>(E)->end())
+            return false;
+
+        // An argument that isn't live before the call may have lost its
+        // pointees.
+        DenseSet<PointsToNode *> Reached;
+        for (Value *V : CI->arg_operands()) {
+            PointsToNode *N = getNode(V);
+            if (V->getType()->isPointerTy() && !N->singlePointee()) {
+                bool HasPointees = false;
+                for (const PointsToRelation *R : Relations)
+                    HasPointees = HasPointees || R->pointee_begin(N) != R->pointee_end(N);
+                if (!HasPointees)
+                    return false;
+            }
+            Pending.push_back(N);
+        }
+        for (PointsToNode *N : *Live->second.first)
+            Pending.push_back(N);
+
+        while (!Pending.empty()) {
+            PointsToNode *N = Pending.pop_back_val();
+            if (!Reached.insert(N).second)
+                continue;
+            for (const PointsToRelation *R : Relations) {
+                for (auto P = R->pointee_begin(N), PE = R->pointee_end(N); P != PE; ++P) {
+                    if (isa<UnknownPointsToNode>(*P))
+                        return false;
+                    if (Seen.insert(*P).second)
+                        Result.push_back(*P);
+                    Pending.push_back(*P);
+                }
+            }
+            // If a node is reachable, then so are its subnodes.
+            for (PointsToNode *Child : N->children)
+                Pending.push_back(Child);
+        }
+    }
+    return true;
 }
 
 std::pair<PointsToNode *, PointsToNode *> makePointsToPair(PointsToNode *Pointer, PointsToNode *Pointee) {
     if (Pointer->pointeesAreSummaryNodes() && !Pointee->isAlwaysSummaryNode()) {
+        if (deferredSummaryNodes != nullptr) {
+            deferredSummaryNodes->insert(Pointee);
+            return {Pointer, Pointee};
+        }
         // If we turn the pointee into a summary node, this may affect what
         // stores to the pointee do. However, these will be added to the
         // worklist again.
@@ -86,11 +448,11 @@ std::pair<PointsToNode *, PointsToNode *> makePointsToPair(PointsToNode *Pointer
     return {Pointer, Pointee};
 }
 
-bool isLive(PointsToNode *N, LivenessSet &L) {
-    return N->singlePointee() || !N->hasPointerType() || L.find(N) != L.end();
+bool isLive(PointsToNode *N, const LivenessSet &L) {
+    return N->singlePointee() || !N->hasPointerType() || L.count(N);
 }
 
-bool isDescendantLive(PointsToNode *N, LivenessSet &L) {
+bool isDescendantLive(PointsToNode *N, const LivenessSet &L) {
     if (isLive(N, L))
         return true;
 
@@ -102,7 +464,7 @@ bool isDescendantLive(PointsToNode *N, LivenessSet &L) {
     return false;
 }
 
-void makeDescendantsAndPointeesLive(LivenessSet &Lin, PointsToNode *N, PointsToRelation &Ain) {
+void makeDescendantsAndPointeesLive(LivenessSet &Lin, PointsToNode *N, const PointsToRelation &Ain) {
     Lin.insert(N);
     for (auto P = Ain.pointee_begin(N), E = Ain.pointee_end(N); P != E; ++P)
         Lin.insert(*P);
@@ -170,7 +532,7 @@ void killDescendants(LivenessSet &Lin, PointsToNode *N) {
         Lin.erase(C);
 }
 
-void subtractKillStoreInst(const CallString &CS, LivenessSet &Lin, PointsToNode *Ptr, PointsToRelation &Ain) {
+void subtractKillStoreInst(const CallString &CS, LivenessSet &Lin, PointsToNode *Ptr, const PointsToRelation &Ain) {
     if (!Ptr->isAggregate()) {
         bool strongUpdate = true;
         PointsToNode *PointedTo = nullptr;
@@ -213,17 +575,17 @@ void subtractKillStoreInst(const CallString &CS, LivenessSet &Lin, PointsToNode
 void LivenessPointsTo::subtractKill(const CallString &CS,
                                     LivenessSet &Lin,
                                     const Instruction *I,
-                                    PointsToRelation &Ain) {
+                                    const PointsToRelation &Ain) {
     assert(!isa<CallInst>(I) && "CallInsts are analysed using a different part of the code.");
-    PointsToNode *N = factory.getNode(I);
+    PointsToNode *N = getNode(I);
 
     if (const StoreInst *SI = dyn_cast<StoreInst>(I)) {
         const Value *Ptr = SI->getPointerOperand();
-        PointsToNode *PtrNode = factory.getNode(Ptr);
+        PointsToNode *PtrNode = getNode(Ptr);
         subtractKillStoreInst(CS, Lin, PtrNode, Ain);
     }
     else if (const AllocaInst *AI = dyn_cast<AllocaInst>(I)) {
-        PointsToNode *Alloca = factory.getNoAliasNode(AI);
+        PointsToNode *Alloca = getNoAliasNode(AI);
         if (!Alloca->isSummaryNode(CS))
             killDescendants(Lin, Alloca);
     }
@@ -265,15 +627,15 @@ void makeDescendantsLive(LivenessSet &Lin, PointsToNode *N) {
         makeDescendantsLive(Lin, D);
 }
 
-void makeDescendantsPointTo(PointsToRelation &Aout, PointsToNode *N, PointsToNode *Pointee, LivenessSet &Lout) {
-    if (Lout.find(N) != Lout.end())
+void makeDescendantsPointTo(PointsToRelation &Aout, PointsToNode *N, PointsToNode *Pointee, const LivenessSet &Lout) {
+    if (Lout.count(N))
         Aout.insert(makePointsToPair(N, Pointee));
 
     for (PointsToNode *D : N->children)
         makeDescendantsPointTo(Aout, D, Pointee, Lout);
 }
 
-bool isPointeeLive(PointsToNode *N, LivenessSet &Lout, PointsToRelation &Ain) {
+bool isPointeeLive(PointsToNode *N, const LivenessSet &Lout, const PointsToRelation &Ain) {
     for (auto P = Ain.pointee_begin(N), E = Ain.pointee_end(N); P != E; ++P)
         if (isLive(*P, Lout))
             return true;
@@ -281,7 +643,7 @@ bool isPointeeLive(PointsToNode *N, LivenessSet &Lout, PointsToRelation &Ain) {
     return false;
 }
 
-bool isPointeeOfDescendantLive(PointsToNode *N, LivenessSet &Lout, PointsToRelation &Ain) {
+bool isPointeeOfDescendantLive(PointsToNode *N, const LivenessSet &Lout, const PointsToRelation &Ain) {
     if (isPointeeLive(N, Lout, Ain))
         return true;
 
@@ -300,9 +662,13 @@ PointsToNode *findDescendantExact(PointsToNode *N, IndexList &L) {
     return nullptr;
 }
 
-void makeChildren(PointsToNode *NoChildren, PointsToNode *SomeChildren) {
+void makeChildren(PointsToNodeFactory &Factory, PointsToNode *NoChildren, PointsToNode *SomeChildren) {
     assert(NoChildren->isFieldSensitive());
     assert(SomeChildren->isFieldSensitive());
+    // Another thread may have created the children in the meantime.
+    auto Guard = Factory.lockNodes();
+    if (NoChildren->isAggregate())
+        return;
     for (auto D : getDescendants(SomeChildren)) {
         if (D.first.empty())
             continue;
@@ -314,16 +680,18 @@ void makeChildren(PointsToNode *NoChildren, PointsToNode *SomeChildren) {
             assert(T->isPointerTy());
             Pointee = findDescendantExact(NoChildren->getSinglePointee(), D.first);
             if (Pointee == nullptr)
-                Pointee = new GEPPointsToNode(NoChildren->getSinglePointee(), T->getPointerElementType(), D.first, nullptr);
+                Pointee = Factory.createGEPNode(NoChildren->getSinglePointee(), T->getPointerElementType(), D.first, nullptr);
         }
-        // The constructor adds the node to the list of children.
-        new GEPPointsToNode(NoChildren, N->NodeType->getPointerElementType(), D.first, Pointee);
+        Factory.createGEPNode(NoChildren, N->NodeType->getPointerElementType(), D.first, Pointee);
     }
 }
 
-void makeChildrenPointer(PointsToNode *NoChildren, PointsToNode *SomeChildren) {
+void makeChildrenPointer(PointsToNodeFactory &Factory, PointsToNode *NoChildren, PointsToNode *SomeChildren) {
     assert(NoChildren->isFieldSensitive());
     assert(SomeChildren->isFieldSensitive());
+    auto Guard = Factory.lockNodes();
+    if (NoChildren->isAggregate())
+        return;
     for (auto D : getDescendants(SomeChildren)) {
         if (D.first.empty())
             continue;
@@ -334,16 +702,15 @@ void makeChildrenPointer(PointsToNode *NoChildren, PointsToNode *SomeChildren) {
         if (NoChildren->singlePointee()) {
             Pointee = findDescendantExact(NoChildren->getSinglePointee(), D.first);
             if (Pointee == nullptr)
-                Pointee = new GEPPointsToNode(NoChildren->getSinglePointee(), T, D.first, nullptr);
+                Pointee = Factory.createGEPNode(NoChildren->getSinglePointee(), T, D.first, nullptr);
         }
-        // The constructor adds the node to the list of children.
         // I don't like the const cast here, but LLVM before version 3.8.0
         // doesn't mark getPointerTo as const, so its needed.
-        new GEPPointsToNode(NoChildren, const_cast<Type*>(T)->getPointerTo(), D.first, Pointee);
+        Factory.createGEPNode(NoChildren, const_cast<Type*>(T)->getPointerTo(), D.first, Pointee);
     }
 }
 
-void unionRefLoadInst(LivenessSet& Lin, PointsToNode *Ptr, PointsToNode *Load, LivenessSet &Lout, PointsToRelation &Ain) {
+void unionRefLoadInst(PointsToNodeFactory &Factory, LivenessSet& Lin, PointsToNode *Ptr, PointsToNode *Load, const LivenessSet &Lout, const PointsToRelation &Ain) {
     if (!Ptr->isAggregate() && isDescendantLive(Load, Lout)) {
         Lin.insert(Ptr);
         for (auto P = Ain.pointee_begin(Ptr), E = Ain.pointee_end(Ptr); P != E; ++P)
@@ -357,7 +724,7 @@ void unionRefLoadInst(LivenessSet& Lin, PointsToNode *Ptr, PointsToNode *Load, L
                 // node), it is because no children have been created for it. We
                 // create them here so that pointer information is correctly
                 // tracked.
-                makeChildren(Load, Ptr);
+                makeChildren(Factory, Load, Ptr);
                 assert(Load->isAggregate());
             }
             else {
@@ -376,7 +743,7 @@ void unionRefLoadInst(LivenessSet& Lin, PointsToNode *Ptr, PointsToNode *Load, L
     }
 }
 
-void unionRefStoreInst(LivenessSet &Lin, PointsToNode *Ptr, PointsToNode *Value, LivenessSet &Lout, PointsToRelation &Ain) {
+void unionRefStoreInst(PointsToNodeFactory &Factory, LivenessSet &Lin, PointsToNode *Ptr, PointsToNode *Value, const LivenessSet &Lout, const PointsToRelation &Ain) {
     if (!Ptr->isAggregate() && !Value->isAggregate()) {
         Lin.insert(Ptr);
 
@@ -393,7 +760,7 @@ void unionRefStoreInst(LivenessSet &Lin, PointsToNode *Ptr, PointsToNode *Value,
                 // node), it is because no children have been created for it. We
                 // create them here so that pointer information is correctly
                 // tracked.
-                makeChildrenPointer(Ptr, Value);
+                makeChildrenPointer(Factory, Ptr, Value);
                 assert(Ptr->isAggregate());
             }
         }
@@ -407,7 +774,7 @@ void unionRefStoreInst(LivenessSet &Lin, PointsToNode *Ptr, PointsToNode *Value,
                 // node), it is because no children have been created for it. We
                 // create them here so that pointer information is correctly
                 // tracked.
-                makeChildren(Value, Ptr);
+                makeChildren(Factory, Value, Ptr);
                 assert(Value->isAggregate());
             }
             else {
@@ -428,38 +795,38 @@ void unionRefStoreInst(LivenessSet &Lin, PointsToNode *Ptr, PointsToNode *Value,
 
 void LivenessPointsTo::unionRef(LivenessSet& Lin,
                                 const Instruction *I,
-                                LivenessSet& Lout,
-                                PointsToRelation& Ain) {
+                                const LivenessSet& Lout,
+                                const PointsToRelation& Ain) {
     if (const LoadInst *LI = dyn_cast<LoadInst>(I)) {
         // We only consider the pointer and the possible values in memory to be
         // ref'd if the load is live.
         const Value *Ptr = LI->getPointerOperand();
-        PointsToNode *PtrNode = factory.getNode(Ptr);
-        PointsToNode *N = factory.getNode(I);
-        unionRefLoadInst(Lin, PtrNode, N, Lout, Ain);
+        PointsToNode *PtrNode = getNode(Ptr);
+        PointsToNode *N = getNode(I);
+        unionRefLoadInst(factory, Lin, PtrNode, N, Lout, Ain);
     }
     else if (const StoreInst *SI = dyn_cast<StoreInst>(I)) {
         const Value *Ptr = SI->getPointerOperand();
-        PointsToNode *PtrNode = factory.getNode(Ptr);
-        PointsToNode *Value = factory.getNode(SI->getValueOperand());
-        unionRefStoreInst(Lin, PtrNode, Value, Lout, Ain);
+        PointsToNode *PtrNode = getNode(Ptr);
+        PointsToNode *Value = getNode(SI->getValueOperand());
+        unionRefStoreInst(factory, Lin, PtrNode, Value, Lout, Ain);
     }
     else if (isa<PHINode>(I) || isa<SelectInst>(I)) {
         // We only consider the operands of a PHI node or select instruction to
         // be ref'd if I is live.
-        PointsToNode *N = factory.getNode(I);
+        PointsToNode *N = getNode(I);
         if (!N->isAggregate()) {
             if (isLive(N, Lout))
                 for (const Use &U : I->operands())
                     if (Value *Operand = dyn_cast<Value>(U))
-                        makeDescendantsLive(Lin, factory.getNode(Operand));
+                        makeDescendantsLive(Lin, getNode(Operand));
         }
         else {
             if (isDescendantLive(N, Lout)) {
                 auto desc = getDescendants(N);
                 for (const Use &U : I->operands()) {
                     if (Value *Operand = dyn_cast<Value>(U)) {
-                        PointsToNode *OperandNode = factory.getNode(Operand);
+                        PointsToNode *OperandNode = getNode(Operand);
                         if (!OperandNode->isAggregate())
                             Lin.insert(OperandNode);
                         else {
@@ -476,8 +843,8 @@ void LivenessPointsTo::unionRef(LivenessSet& Lin,
     }
     else if (const BitCastInst *CI = dyn_cast<BitCastInst>(I)) {
         if (!canHandleBitcast(CI)) {
-            if (isLive(factory.getNode(CI), Lout))
-                makeDescendantsLive(Lin, factory.getNode(CI->getOperand(0)));
+            if (isLive(getNode(CI), Lout))
+                makeDescendantsLive(Lin, getNode(CI->getOperand(0)));
         }
     }
     else {
@@ -485,7 +852,7 @@ void LivenessPointsTo::unionRef(LivenessSet& Lin,
         // operands to be ref'd, even if the instruction is not live.
         for (const Use &U : I->operands())
             if (Value *Operand = dyn_cast<Value>(U))
-                makeDescendantsLive(Lin, factory.getNode(Operand));
+                makeDescendantsLive(Lin, getNode(Operand));
     }
 }
 
@@ -501,7 +868,7 @@ void unionDescendants(SmallVector<std::pair<IndexList, PointsToNode *>, 8> &S, c
     }
 }
 
-void unionPointeesWithDescendants(SmallVector<std::pair<IndexList, PointsToNode *>, 8> &Pointees, PointsToRelation &Ain, const IndexList &L, PointsToNode *N) {
+void unionPointeesWithDescendants(SmallVector<std::pair<IndexList, PointsToNode *>, 8> &Pointees, const PointsToRelation &Ain, const IndexList &L, PointsToNode *N) {
     if (isa<UnknownPointsToNode>(N)) {
         // Assume here that ?-->?.
         Pointees.push_back({L, N});
@@ -520,17 +887,17 @@ void unionPointeesWithDescendants(SmallVector<std::pair<IndexList, PointsToNode
     }
 }
 
-void unionRelationApplicationWithDescendants(SmallVector<std::pair<IndexList, PointsToNode *>, 8> &Pointees, PointsToRelation &Ain, const SmallVector<std::pair<IndexList, PointsToNode *>, 8> &S) {
+void unionRelationApplicationWithDescendants(SmallVector<std::pair<IndexList, PointsToNode *>, 8> &Pointees, const PointsToRelation &Ain, const SmallVector<std::pair<IndexList, PointsToNode *>, 8> &S) {
     for (auto P : S)
         unionPointeesWithDescendants(Pointees, Ain, P.first, P.second);
 }
 
-void insertNewPairsLoadInst(PointsToRelation &Aout, PointsToNode *Load, PointsToNode *Ptr, PointsToNode *Unknown, PointsToRelation &Ain, LivenessSet &Lout) {
+void insertNewPairsLoadInst(PointsToRelation &Aout, PointsToNode *Load, PointsToNode *Ptr, PointsToNode *Unknown, const PointsToRelation &Ain, const LivenessSet &Lout) {
     if (!Load->isAggregate()) {
         if (!isLive(Load, Lout))
             return;
 
-        std::set<PointsToNode *> t;
+        PointsToRelation::NodeSet t;
         for (auto P = Ain.pointee_begin(Ptr), E = Ain.pointee_end(Ptr); P != E; ++P)
             t.insert(*P);
         for (auto P = Ain.restriction_begin(t), E = Ain.restriction_end(t); P != E; ++P)
@@ -563,10 +930,10 @@ void insertNewPairsLoadInst(PointsToRelation &Aout, PointsToNode *Load, PointsTo
     }
 }
 
-void insertNewPairsStoreInst(PointsToRelation &Aout, PointsToNode *Ptr, PointsToNode *Value, PointsToNode *Unknown, PointsToRelation &Ain, LivenessSet &Lout) {
+void insertNewPairsStoreInst(PointsToRelation &Aout, PointsToNode *Ptr, PointsToNode *Value, PointsToNode *Unknown, const PointsToRelation &Ain, const LivenessSet &Lout) {
     if (!Ptr->isAggregate() && !Value->isAggregate()) {
         for (auto P = Ain.pointee_begin(Ptr), PE = Ain.pointee_end(Ptr); P != PE; ++P) {
-            if (Lout.find(*P) != Lout.end())
+            if (Lout.count(*P))
                 for (auto Q = Ain.pointee_begin(Value), QE = Ain.pointee_end(Value); Q != QE; ++Q)
                     Aout.insert(makePointsToPair(*P, *Q));
         }
@@ -577,7 +944,7 @@ void insertNewPairsStoreInst(PointsToRelation &Aout, PointsToNode *Ptr, PointsTo
         unionPointeesWithDescendants(ptrPointees, Ain, l, Ptr);
         unionPointeesWithDescendants(valuePointees, Ain, l, Value);
         for (auto P : ptrPointees) {
-            if (Lout.find(P.second) != Lout.end()) {
+            if (Lout.count(P.second)) {
                 for (auto Q : valuePointees) {
                     switch (matchIndexLists(P.first, Q.first)) {
                         case Exact:
@@ -596,9 +963,9 @@ void insertNewPairsStoreInst(PointsToRelation &Aout, PointsToNode *Ptr, PointsTo
     }
 }
 
-void insertNewPairsAssignment(PointsToRelation &Aout, PointsToNode *L, PointsToNode *R, PointsToNode *Unknown, PointsToRelation &Ain, LivenessSet &Lout) {
+void insertNewPairsAssignment(PointsToRelation &Aout, PointsToNode *L, PointsToNode *R, PointsToNode *Unknown, const PointsToRelation &Ain, const LivenessSet &Lout) {
     if (!L->isAggregate() && !R->isAggregate()) {
-        if (Lout.find(L) == Lout.end())
+        if (!Lout.count(L))
             return;
 
         for (auto P = Ain.pointee_begin(R), E = Ain.pointee_end(R); P != E; ++P)
@@ -609,7 +976,7 @@ void insertNewPairsAssignment(PointsToRelation &Aout, PointsToNode *L, PointsToN
         IndexList l;
         unionPointeesWithDescendants(pointees, Ain, l, R);
         for (auto D : getDescendants(L)) {
-            if (Lout.find(D.second) != Lout.end()) {
+            if (Lout.count(D.second)) {
                 for (auto P : pointees) {
                     switch (matchIndexLists(D.first, P.first)) {
                         case Exact:
@@ -628,31 +995,31 @@ void insertNewPairsAssignment(PointsToRelation &Aout, PointsToNode *L, PointsToN
     }
 }
 
-void LivenessPointsTo::insertNewPairs(PointsToRelation &Aout, const Instruction *I, PointsToRelation &Ain, LivenessSet &Lout) {
+void LivenessPointsTo::insertNewPairs(PointsToRelation &Aout, const Instruction *I, const PointsToRelation &Ain, const LivenessSet &Lout) {
     PointsToNode *Unknown = factory.getUnknown();
     if (const LoadInst *LI = dyn_cast<LoadInst>(I)) {
-        PointsToNode *Load = factory.getNode(LI);
-        PointsToNode *Pointer = factory.getNode(LI->getPointerOperand());
+        PointsToNode *Load = getNode(LI);
+        PointsToNode *Pointer = getNode(LI->getPointerOperand());
         insertNewPairsLoadInst(Aout, Load, Pointer, Unknown, Ain, Lout);
     }
     else if (const StoreInst *SI = dyn_cast<StoreInst>(I)) {
-        PointsToNode *Ptr = factory.getNode(SI->getPointerOperand());
-        PointsToNode *Value = factory.getNode(SI->getValueOperand());
+        PointsToNode *Ptr = getNode(SI->getPointerOperand());
+        PointsToNode *Value = getNode(SI->getValueOperand());
         insertNewPairsStoreInst(Aout, Ptr, Value, Unknown, Ain, Lout);
     }
     else if (const SelectInst *SI = dyn_cast<SelectInst>(I)) {
-        PointsToNode *Select = factory.getNode(SI);
-        insertNewPairsAssignment(Aout, Select, factory.getNode(SI->getFalseValue()), Unknown, Ain, Lout);
-        insertNewPairsAssignment(Aout, Select, factory.getNode(SI->getTrueValue()), Unknown, Ain, Lout);
+        PointsToNode *Select = getNode(SI);
+        insertNewPairsAssignment(Aout, Select, getNode(SI->getFalseValue()), Unknown, Ain, Lout);
+        insertNewPairsAssignment(Aout, Select, getNode(SI->getTrueValue()), Unknown, Ain, Lout);
     }
     else if (const PHINode *Phi = dyn_cast<PHINode>(I)) {
-        PointsToNode *N = factory.getNode(Phi);
+        PointsToNode *N = getNode(Phi);
         for (auto &V : Phi->incoming_values())
-            insertNewPairsAssignment(Aout, N, factory.getNode(V), Unknown, Ain, Lout);
+            insertNewPairsAssignment(Aout, N, getNode(V), Unknown, Ain, Lout);
     }
     else if (const GEPOperator *GEP = dyn_cast<GEPOperator>(I)) {
-        PointsToNode *N = factory.getNode(GEP);
-        PointsToNode *Ptr = factory.getNode(GEP->getPointerOperand());
+        PointsToNode *N = getNode(GEP);
+        PointsToNode *Ptr = getNode(GEP->getPointerOperand());
         if (N->singlePointee()) {
             // The points to pair for N is implicit, so nothing needs to be added
             // here.
@@ -665,7 +1032,7 @@ void LivenessPointsTo::insertNewPairs(PointsToRelation &Aout, const Instruction
             return;
         }
 
-        if (Lout.find(N) == Lout.end())
+        if (!Lout.count(N))
             return;
 
         assert(GEP->hasAllConstantIndices());
@@ -681,12 +1048,12 @@ void LivenessPointsTo::insertNewPairs(PointsToRelation &Aout, const Instruction
         }
     }
     else if (const AllocaInst *AI = dyn_cast<AllocaInst>(I)) {
-        PointsToNode *Alloca = factory.getNoAliasNode(AI);
+        PointsToNode *Alloca = getNoAliasNode(AI);
         makeDescendantsPointTo(Aout, Alloca, Unknown, Lout);
     }
     else if (const BitCastInst *CI = dyn_cast<BitCastInst>(I)) {
         if (!canHandleBitcast(CI))
-            makeDescendantsPointTo(Aout, factory.getNode(CI), Unknown, Lout);
+            makeDescendantsPointTo(Aout, getNode(CI), Unknown, Lout);
     }
 }
 
@@ -694,58 +1061,82 @@ ProcedurePointsTo *LivenessPointsTo::getPointsTo(Function &F) const {
     return data.getAtFunction(&F);
 }
 
-bool hasPointee(PointsToRelation &S, PointsToNode *N) {
+bool LivenessPointsTo::hasPointsTo(const Function &F) const {
+    return data.hasDataForFunction(&F);
+}
+
+bool hasPointee(const PointsToRelation &S, PointsToNode *N) {
     return S.pointee_begin(N) != S.pointee_end(N);
 }
 
-void LivenessPointsTo::computeLout(const Instruction *I, LivenessSet& Lout, IntraproceduralPointsTo &Result) {
+void LivenessPointsTo::computeLout(const Instruction *I, const InstructionGraph &G, const LivenessSet *&Lout, IntraproceduralPointsTo &Result) {
     if (isa<ReturnInst>(I)) {
         // After a return instruction, nothing is live.
     }
     else if (const TerminatorInst *TI = dyn_cast<TerminatorInst>(I)) {
         // If this instruction is a terminator, it may have multiple
         // successors.
-        Lout.clear();
+        if (TI->getNumSuccessors() == 1) {
+            Instruction *Succ = TI->getSuccessor(0)->begin();
+            auto succ_result = Result.find(Succ);
+            assert(succ_result != Result.end());
+            Lout = succ_result->second.first;
+            return;
+        }
+
+        LivenessSet n;
         for (unsigned i = 0; i < TI->getNumSuccessors(); i++) {
             Instruction *Succ = TI->getSuccessor(i)->begin();
             auto succ_result = Result.find(Succ);
             assert(succ_result != Result.end());
             auto succ_lin = succ_result->second.first;
-            Lout.insertAll(*succ_lin);
+            n.insertAll(*succ_lin);
         }
+        Lout = data.intern(n);
     }
     else {
         // If this instruction is not a terminator, it has exactly one
-        // successor -- the next instruction in the function.
-        const Instruction *Succ = getNextInstruction(I);
+        // successor -- the next instruction in the graph.
+        const Instruction *Succ = G.getNext(I);
         auto succ_result = Result.find(Succ);
         assert(succ_result != Result.end());
         auto succ_lin = succ_result->second.first;
-        if (*succ_lin != Lout) {
-            assert(succ_lin->isSubset(Lout));
-            Lout.clear();
-            Lout.insertAll(*succ_lin);
+        if (succ_lin != Lout) {
+            assert(succ_lin->isSubset(*Lout));
+            Lout = succ_lin;
         }
     }
 }
 
 bool LivenessPointsTo::isArgument(const Function *F, const PointsToNode *N) {
-    for (auto I = F->arg_begin(), E = F->arg_end(); I != E; ++I)
-        if (factory.getNode(&*I) == N)
-            return true;
+    return getInfo(F).Arguments.count(N);
+}
+const PointsToRelation *LivenessPointsTo::restrictRelation(const PointsToRelation *R, const LivenessSet *L) {
+    // Since the relations and sets are interned, the result of restricting a
+    // relation to a set never changes, so it can be cached. Straight-line code
+    // restricts the same relation to the same set over and over again.
+    auto Cached = restrictions.find(std::make_pair(R, L));
+    if (Cached != restrictions.end())
+        return Cached->second;
 
-    return false;
+    PointsToRelation s;
+    s.unionRelationRestriction(*R, *L);
+    const PointsToRelation *Result = data.intern(s);
+    restrictions.insert(std::make_pair(std::make_pair(R, L), Result));
+    return Result;
 }
-bool LivenessPointsTo::computeAin(const Instruction *I, const Function *F, PointsToRelation &Ain, LivenessSet &Lin, IntraproceduralPointsTo *Result, bool InsertAtFirstInstruction) {
+
+bool LivenessPointsTo::computeAin(const Instruction *I, const Function *F, const InstructionGraph &G, const PointsToRelation *&Ain, const LivenessSet *Lin, IntraproceduralPointsTo *Result, bool InsertAtFirstInstruction) {
     // Compute ain for the current instruction.
-    PointsToRelation s;
+    const PointsToRelation *S;
     if (I == &*inst_begin(F)) {
-        s = Ain;
+        S = Ain;
         if (InsertAtFirstInstruction) {
             // If this is the first instruction of the function, then apart from
             // the data in entry, we don't know what anything points to. ain
             // already contains the data in entry, so add the remaining pairs.
-            for (PointsToNode *N : Lin) {
+            PointsToRelation s = *Ain;
+            for (PointsToNode *N : *Lin) {
                 if (!hasPointee(s, N)) {
                     if (isa<GlobalPointsToNode>(N) || isArgument(F, N)) {
                         // We don't know what globals are initialized to, but they
@@ -759,6 +1150,7 @@ bool LivenessPointsTo::computeAin(const Instruction *I, const Function *F, Point
                     }
                 }
             }
+            S = data.intern(s);
         }
     }
     else {
@@ -767,6 +1159,7 @@ bool LivenessPointsTo::computeAin(const Instruction *I, const Function *F, Point
         const BasicBlock *BB = I->getParent();
         const Instruction *FirstInBB = BB->begin();
         if (FirstInBB == I) {
+            PointsToRelation s;
             for (const_pred_iterator PI = pred_begin(BB), E = pred_end(BB);
                  PI != E;
                  ++PI) {
@@ -774,79 +1167,143 @@ bool LivenessPointsTo::computeAin(const Instruction *I, const Function *F, Point
                 const Instruction *Pred = --(PredBB->end());
                 auto pred_result = Result->find(Pred);
                 assert(pred_result != Result->end());
-                PointsToRelation *PredAout = pred_result->second.second;
-                s.unionRelationRestriction(*PredAout, Lin);
+                const PointsToRelation *PredAout = pred_result->second.second;
+                s.insertAll(*restrictRelation(PredAout, Lin));
             }
+            S = data.intern(s);
         }
         else {
-            const Instruction *Pred = getPreviousInstruction(I);
+            const Instruction *Pred = G.getPrevious(I);
             auto pred_result = Result->find(Pred);
             assert(pred_result != Result->end());
-            PointsToRelation *PredAout = pred_result->second.second;
-            s.unionRelationRestriction(*PredAout, Lin);
+            const PointsToRelation *PredAout = pred_result->second.second;
+            S = restrictRelation(PredAout, Lin);
         }
     }
-    if (s != Ain) {
-        assert(s.isSubset(Ain));
-        Ain.clear();
-        Ain.insertAll(s);
+    if (S != Ain) {
+        assert(S->isSubset(*Ain));
+        Ain = S;
         return true;
     }
 
     return false;
 }
 
-bool LivenessPointsTo::getCalledFunctions(SmallVector<const Function *, 8> &Result, const CallInst *CI, PointsToRelation &Ain) {
+bool LivenessPointsTo::getCalledFunctions(SmallVector<const Function *, 8> &Result, const CallInst *CI, const PointsToRelation &Ain) {
     if (CI->getCalledFunction() != nullptr) {
         Result.push_back(CI->getCalledFunction());
         return false;
     }
 
+    // Ain is interned, so the targets only need to be found again when the
+    // call is reached with a different relation.
+    auto Key = std::make_pair(CI, &Ain);
+    auto Cached = indirectTargets.find(Key);
+    if (Cached == indirectTargets.end()) {
+        IndirectTargets Targets;
+        Targets.Unknown = findIndirectTargets(Targets.Functions, CI, Ain);
+        Cached = indirectTargets.insert(std::make_pair(Key, Targets)).first;
+    }
+    Result.append(Cached->second.Functions.begin(), Cached->second.Functions.end());
+    return Cached->second.Unknown;
+}
+
+bool LivenessPointsTo::findIndirectTargets(SmallVectorImpl<const Function *> &Result, const CallInst *CI, const PointsToRelation &Ain) {
+    // Calling a function through a pointer of a different type, or calling
+    // something that isn't a function, is undefined, so those targets are
+    // dropped. A function can only be called indirectly if its address is
+    // taken. Calls of constants, such as casts of functions, are how C calls
+    // functions with mismatched declarations, so they aren't filtered.
+    const Value *Called = CI->getCalledValue();
+    const FunctionType *CalledType = cast<FunctionType>(cast<PointerType>(Called->getType())->getElementType());
+    bool filter = !isa<Constant>(Called);
+
     // Use Ain to work out what the called value can point to.
-    PointsToNode *CalledValue = factory.getNode(CI->getCalledValue());
+    PointsToNode *CalledValue = getNode(Called);
     for (auto I = Ain.pointee_begin(CalledValue), E = Ain.pointee_end(CalledValue); I != E; ++I) {
         if (isa<UnknownPointsToNode>(*I))
             return true;
 
         const Function *F = (*I)->getFunction();
         if (F == nullptr) {
+            if (filter && (isa<GlobalPointsToNode>(*I) || isa<NoAliasPointsToNode>(*I)))
+                continue;
             // Couldn't find a function corresponding to *I.
             return true;
         }
-        else
+        else if (!filter || (F->getFunctionType() == CalledType && F->hasAddressTaken()))
             Result.push_back(F);
     }
 
     return false;
 }
 
-void LivenessPointsTo::addLinCalledDeclaration(LivenessSet &N, const CallString &CS, const CallInst *CI, LivenessSet &Lout) {
+void LivenessPointsTo::addLinCalledDeclaration(LivenessSet &N, const CallString &CS, const CallInst *CI, const LivenessSet &Lout) {
     // We reach this point if we have a declaration. Just assume the worst case
     // -- the function may invalidate or use anything that it has access to.
     LivenessSet n = Lout;
     if (CI->paramHasAttr(0, Attribute::NoAlias)) {
-        PointsToNode *NoAlias = factory.getNoAliasNode(CI);
+        PointsToNode *NoAlias = getNoAliasNode(CI);
         if (!NoAlias->isSummaryNode(CS))
             killDescendants(n, NoAlias);
     }
 
     for (Value *V : CI->arg_operands())
-        n.insert(factory.getNode(V));
+        n.insert(getNode(V));
 
     // TODO: This isn't very efficient...
     N.insertAll(n);
 }
 
-void LivenessPointsTo::addLinAnalysableCalledFunction(LivenessSet &N, const Function *Called, const CallString &CS, const CallInst *CI, LivenessSet &Lout, LivenessSet &Relevant) {
-    CallString newCS = CS.addCallSite(CI);
-    // The set of values that are returned from the function.
-    std::set<PointsToNode *> returnValues = getReturnValues(Called);
+// Returns true if the memory that N points to may be live after a call that
+// writes to it. If N may point to unknown memory, anything may be written.
+bool isCopyDestinationLive(PointsToNode *N, const LivenessSet &Lout, const PointsToRelation &Ain) {
+    for (auto P = Ain.pointee_begin(N), E = Ain.pointee_end(N); P != E; ++P) {
+        if (isa<UnknownPointsToNode>(*P))
+            return true;
+        for (auto D : getDescendants(*P))
+            if (Lout.count(D.second))
+                return true;
+    }
+
+    return false;
+}
+
+void LivenessPointsTo::addLinModelledDeclaration(LivenessSet &N, const CallString &CS, const CallInst *CI, const LibraryModel &M, const PointsToRelation &Ain, const LivenessSet &Lout) {
+    LivenessSet n = Lout;
+    for (Value *V : CI->arg_operands())
+        n.insert(getNode(V));
+
+    // The allocation doesn't exist before the call.
+    if (M.Allocates) {
+        PointsToNode *NoAlias = getNoAliasNode(CI);
+        if (!NoAlias->isSummaryNode(CS))
+            killDescendants(n, NoAlias);
+    }
 
-    std::pair<LivenessSet, PointsToRelation> calledFunctionResult = getCalledFunctionResult(newCS, Called);
-    auto calledFunctionLin = calledFunctionResult.first;
-    auto calledFunctionAout = calledFunctionResult.second;
+    if (Lout.count(getNode(CI)))
+        for (unsigned A : M.ReturnedArguments)
+            makeDescendantsLive(n, getNode(CI->getArgOperand(A)));
 
-    LivenessSet n = replaceFormalArgumentsWithActual(CS, Called, CI, calledFunctionLin, Relevant);
+    // Copies are weak updates, so nothing that is written is killed; what is
+    // read is live if what it is written to is.
+    for (auto &C : M.Copies) {
+        if (!isCopyDestinationLive(getNode(CI->getArgOperand(C.second)), Lout, Ain))
+            continue;
+        PointsToNode *From = getNode(CI->getArgOperand(C.first));
+        for (auto P = Ain.pointee_begin(From), E = Ain.pointee_end(From); P != E; ++P)
+            if (!isa<UnknownPointsToNode>(*P))
+                makeDescendantsLive(n, *P);
+    }
+
+    N.insertAll(n);
+}
+
+void LivenessPointsTo::addLinAnalysableCalledFunction(LivenessSet &N, const Function *Called, const CallString &CS, const CallInst *CI, const LivenessSet &Lout, const LivenessSet &Relevant) {
+    CallString newCS = extendCallString(CS, CI);
+    const LivenessSet *calledFunctionLin = getCalledFunctionResult(newCS, Called).first;
+
+    LivenessSet n = replaceFormalArgumentsWithActual(CS, Called, CI, *calledFunctionLin, Relevant);
     for (auto I = Lout.begin(), E = Lout.end(); I != E; ++I) {
         if ((*I)->isSummaryNode(CS)) {
             // We shouldn't allow the function call to kill this
@@ -859,11 +1316,11 @@ void LivenessPointsTo::addLinAnalysableCalledFunction(LivenessSet &N, const Func
     N.insertAll(n);
 }
 
-LivenessSet LivenessPointsTo::findRelevantNodes(const CallInst *CI, LivenessSet &Lout) {
+LivenessSet LivenessPointsTo::findRelevantNodes(const CallInst *CI, const LivenessSet &Lout) {
     LivenessSet reachable = Lout;
 
     for (Value *V : CI->arg_operands()) {
-        PointsToNode *Node = factory.getNode(V);
+        PointsToNode *Node = getNode(V);
         makeDescendantsLive(reachable, Node);
     }
 
@@ -871,9 +1328,9 @@ LivenessSet LivenessPointsTo::findRelevantNodes(const CallInst *CI, LivenessSet
 }
 
 
-bool LivenessPointsTo::computeLin(const CallString &CS, const Instruction *I, PointsToRelation &Ain, LivenessSet &Lin, LivenessSet &Lout) {
+bool LivenessPointsTo::computeLin(const CallString &CS, const Instruction *I, const PointsToRelation &Ain, const LivenessSet *&Lin, const LivenessSet &Lout) {
     if (const CallInst *CI = dyn_cast<CallInst>(I)) {
-        PointsToNode *CINode = factory.getNode(CI);
+        PointsToNode *CINode = getNode(CI);
 
         SmallVector<const Function *, 8> CalledFunctions;
         bool pointsToUnknown = getCalledFunctions(CalledFunctions, CI, Ain);
@@ -883,12 +1340,16 @@ bool LivenessPointsTo::computeLin(const CallString &CS, const Instruction *I, Po
         if (pointsToUnknown) {
             // The function is undefined -- just insert what's already there for
             // monotonicity
-            n = Lin;
+            n = *Lin;
         }
         else {
             for (const Function *Called : CalledFunctions) {
-                if (Called->isDeclaration())
-                    addLinCalledDeclaration(n, CS, CI, Lout);
+                if (Called->isDeclaration()) {
+                    if (const LibraryModel *M = getLibraryModel(CI, Called))
+                        addLinModelledDeclaration(n, CS, CI, *M, Ain, Lout);
+                    else
+                        addLinCalledDeclaration(n, CS, CI, Lout);
+                }
                 else
                     addLinAnalysableCalledFunction(n, Called, CS, CI, Lout, relevant);
             }
@@ -900,22 +1361,22 @@ bool LivenessPointsTo::computeLin(const CallString &CS, const Instruction *I, Po
         // and the noalias node is not a summary node, then it can
         // be killed here.
         if (CI->paramHasAttr(0, Attribute::NoAlias)) {
-            PointsToNode *NoAliasNode = factory.getNoAliasNode(CI);
+            PointsToNode *NoAliasNode = getNoAliasNode(CI);
             if (!NoAliasNode->isSummaryNode(CS))
                 n.erase(NoAliasNode);
         }
 
         // The function is live.
-        PointsToNode *CalledValue = factory.getNode(CI->getCalledValue());
+        PointsToNode *CalledValue = getNode(CI->getCalledValue());
         makeDescendantsLive(n, CalledValue);
 
         // If the two sets are the same, then no changes need to be made to lin,
         // so don't do anything here. Otherwise, we need to update lin and add
         // the predecessors of the current instruction to the worklist.
-        if (n != Lin) {
-            assert(n.isSubset(Lin));
-            Lin.clear();
-            Lin.insertAll(n);
+        const LivenessSet *N = data.intern(n);
+        if (N != Lin) {
+            assert(N->isSubset(*Lin));
+            Lin = N;
             return true;
         }
         else
@@ -930,10 +1391,10 @@ bool LivenessPointsTo::computeLin(const CallString &CS, const Instruction *I, Po
         // If the two sets are the same, then no changes need to be made to lin,
         // so don't do anything here. Otherwise, we need to update lin and add
         // the predecessors of the current instruction to the worklist.
-        if (n != Lin) {
-            assert(n.isSubset(Lin));
-            Lin.clear();
-            Lin.insertAll(n);
+        const LivenessSet *N = data.intern(n);
+        if (N != Lin) {
+            assert(N->isSubset(*Lin));
+            Lin = N;
             return true;
         }
         else
@@ -941,8 +1402,8 @@ bool LivenessPointsTo::computeLin(const CallString &CS, const Instruction *I, Po
     }
 }
 
-void LivenessPointsTo::addAoutCalledDeclaration(PointsToRelation &S, const CallInst *CI, PointsToRelation &Ain, LivenessSet &Lout) {
-    PointsToNode *CINode = factory.getNode(CI);
+void LivenessPointsTo::addAoutCalledDeclaration(PointsToRelation &S, const CallInst *CI, const PointsToRelation &Ain, const LivenessSet &Lout) {
+    PointsToNode *CINode = getNode(CI);
 
     // Anything that can be modified by the function (including the return value
     // unless it has the noalias attribute) anything that is reachable, and
@@ -954,12 +1415,12 @@ void LivenessPointsTo::addAoutCalledDeclaration(PointsToRelation &S, const CallI
     if (!CI->paramHasAttr(0, Attribute::NoAlias))
         killable.insert(CINode);
     else {
-        PointsToNode *NoAliasNode = factory.getNoAliasNode(CI);
+        PointsToNode *NoAliasNode = getNoAliasNode(CI);
         killable.insert(NoAliasNode);
     }
 
     for (PointsToNode *N : killable) {
-        if (Lout.find(N) != Lout.end()) {
+        if (Lout.count(N)) {
             // N can point to anything that is killable from the callee, plus
             // a noalias summary node.
             for (PointsToNode *M : addressable) {
@@ -977,16 +1438,13 @@ void LivenessPointsTo::addAoutCalledDeclaration(PointsToRelation &S, const CallI
     S.insertAll(s);
 }
 
-void LivenessPointsTo::addAoutAnalysableCalledFunction(PointsToRelation &S, const Function *Called, const CallString &CS, const CallInst *CI, PointsToRelation &Ain, LivenessSet &Lout) {
-    CallString newCS = CS.addCallSite(CI);
+void LivenessPointsTo::addAoutAnalysableCalledFunction(PointsToRelation &S, const Function *Called, const CallString &CS, const CallInst *CI, const PointsToRelation &Ain, const LivenessSet &Lout) {
+    CallString newCS = extendCallString(CS, CI);
     // The set of values that are returned from the function.
-    std::set<PointsToNode *> returnValues = getReturnValues(Called);
-
-    std::pair<LivenessSet, PointsToRelation> calledFunctionResult = getCalledFunctionResult(newCS, Called);
-    auto calledFunctionLin = calledFunctionResult.first;
-    auto calledFunctionAout = calledFunctionResult.second;
+    const std::set<PointsToNode *> &returnValues = getReturnValues(Called);
+    const PointsToRelation *calledFunctionAout = getCalledFunctionResult(newCS, Called).second;
 
-    PointsToRelation s = replaceReturnValuesWithCallInst(CI, calledFunctionAout, returnValues, Lout);
+    PointsToRelation s = replaceReturnValuesWithCallInst(CI, *calledFunctionAout, returnValues, Lout);
     for (auto I = Ain.begin(), E = Ain.end(); I != E; ++I) {
         if (I->first->isSummaryNode(CS)) {
             // We shouldn't allow the function call to remove
@@ -999,35 +1457,70 @@ void LivenessPointsTo::addAoutAnalysableCalledFunction(PointsToRelation &S, cons
     S.insertAll(s);
 }
 
-bool isConstant(const Function *Called) {
-    StringRef Name = Called->getName();
-    if (Name == "fprintf"
-     || Name == "fflush"
-     || Name == "fwrite"
-     || Name == "fputc"
-     || Name == "llvm.lifetime.start"
-     || Name == "llvm.lifetime.end"
-     || Name == "strcmp"
-     || Name == "strlen"
-     || Name == "printf"
-     || Name == "exit"
-     || Name == "putchar"
-     || Name == "sprintf"
-     || Name == "strtol"
-     || Name == "puts"
-     || Name == "strncmp"
-     || Name == "_IO_putc"
-     || Name == "fclose"
-     || Name == "malloc"
-     || Name == "calloc"
-     || Name == "floor"
-     || Name == "ceil")
-            return true;
-    else
-        return false;
+void LivenessPointsTo::addAoutModelledDeclaration(PointsToRelation &S, const CallInst *CI, const LibraryModel &M, const PointsToRelation &Ain, const LivenessSet &Lout) {
+    PointsToNode *CINode = getNode(CI);
+    PointsToNode *Unknown = factory.getUnknown();
+
+    // A destination which may be unknown memory could be anything, so the
+    // call has to be handled conservatively.
+    for (auto &C : M.Copies) {
+        PointsToNode *To = getNode(CI->getArgOperand(C.second));
+        for (auto P = Ain.pointee_begin(To), E = Ain.pointee_end(To); P != E; ++P) {
+            if (isa<UnknownPointsToNode>(*P)) {
+                addAoutCalledDeclaration(S, CI, Ain, Lout);
+                return;
+            }
+        }
+    }
+
+    // Nothing is killed, since the copies are weak updates.
+    PointsToRelation s;
+    s.unionRelationRestriction(Ain, Lout);
+
+    // If the return value has the noalias attribute then its node already
+    // points to the allocation.
+    if (M.Allocates && !CI->paramHasAttr(0, Attribute::NoAlias) && Lout.count(CINode))
+        s.insert(makePointsToPair(CINode, getNoAliasNode(CI)));
+
+    for (unsigned A : M.ReturnedArguments)
+        insertNewPairsAssignment(s, CINode, getNode(CI->getArgOperand(A)), Unknown, Ain, Lout);
+
+    // Every live part of the destination may point to anything that any part
+    // of the source points to.
+    for (auto &C : M.Copies) {
+        PointsToNode *From = getNode(CI->getArgOperand(C.first));
+        PointsToNode *To = getNode(CI->getArgOperand(C.second));
+        SmallVector<PointsToNode *, 8> values;
+        for (auto P = Ain.pointee_begin(From), PE = Ain.pointee_end(From); P != PE; ++P) {
+            if (isa<UnknownPointsToNode>(*P)) {
+                values.push_back(Unknown);
+                continue;
+            }
+            for (auto D : getDescendants(*P))
+                for (auto Q = Ain.pointee_begin(D.second), QE = Ain.pointee_end(D.second); Q != QE; ++Q)
+                    values.push_back(*Q);
+        }
+
+        for (auto P = Ain.pointee_begin(To), PE = Ain.pointee_end(To); P != PE; ++P)
+            for (auto D : getDescendants(*P))
+                if (Lout.count(D.second))
+                    for (PointsToNode *V : values)
+                        s.insert(makePointsToPair(D.second, V));
+    }
+
+    S.insertAll(s);
+}
+
+const LibraryModel *LivenessPointsTo::getLibraryModel(const CallInst *CI, const Function *Called) {
+    auto Cached = libraryModels.find(Called);
+    if (Cached == libraryModels.end())
+        Cached = libraryModels.insert(std::make_pair(Called, LibraryModels::get().lookup(Called))).first;
+
+    const LibraryModel *M = Cached->second;
+    return M != nullptr && M->appliesTo(CI) ? M : nullptr;
 }
 
-bool LivenessPointsTo::computeAout(const CallString &CS, const Instruction *I, PointsToRelation &Ain, PointsToRelation &Aout, LivenessSet &Lout) {
+bool LivenessPointsTo::computeAout(const CallString &CS, const Instruction *I, const PointsToRelation &Ain, const PointsToRelation *&Aout, const LivenessSet &Lout) {
     if (const CallInst *CI = dyn_cast<CallInst>(I)) {
         if (CI->doesNotReturn()) {
             // If the function does not return, then it doesn't matter what
@@ -1042,15 +1535,13 @@ bool LivenessPointsTo::computeAout(const CallString &CS, const Instruction *I, P
         if (pointsToUnknown) {
             // The function is undefined -- just copy what is already
             // there for monotonicity.
-            s = Aout;
+            s = *Aout;
         }
         else {
             for (const Function *Called : CalledFunctions) {
                 if (Called->isDeclaration()) {
-                    if (isConstant(Called)) {
-                        // This call does not change anything.
-                        s.unionRelationRestriction(Ain, Lout);
-                    }
+                    if (const LibraryModel *M = getLibraryModel(CI, Called))
+                        addAoutModelledDeclaration(s, CI, *M, Ain, Lout);
                     else
                         addAoutCalledDeclaration(s, CI, Ain, Lout);
                 }
@@ -1059,10 +1550,10 @@ bool LivenessPointsTo::computeAout(const CallString &CS, const Instruction *I, P
             }
         }
 
-        if (s != Aout) {
-            assert(s.isSubset(Aout));
-            Aout.clear();
-            Aout.insertAll(s);
+        const PointsToRelation *S = data.intern(s);
+        if (S != Aout) {
+            assert(S->isSubset(*Aout));
+            Aout = S;
             return true;
         }
         else
@@ -1075,10 +1566,10 @@ bool LivenessPointsTo::computeAout(const CallString &CS, const Instruction *I, P
         subtractKill(CS, notKilled, I, Ain);
         s.unionRelationRestriction(Ain, notKilled);
         insertNewPairs(s, I, Ain, Lout);
-        if (s != Aout) {
-            assert(s.isSubset(Aout));
-            Aout.clear();
-            Aout.insertAll(s);
+        const PointsToRelation *S = data.intern(s);
+        if (S != Aout) {
+            assert(S->isSubset(*Aout));
+            Aout = S;
             return true;
         }
         else
@@ -1086,7 +1577,7 @@ bool LivenessPointsTo::computeAout(const CallString &CS, const Instruction *I, P
     }
 }
 
-std::set<PointsToNode *> LivenessPointsTo::getKillableDeclaration(const CallInst *CI, PointsToRelation &Ain) {
+std::set<PointsToNode *> LivenessPointsTo::getKillableDeclaration(const CallInst *CI, const PointsToRelation &Ain) {
     std::set<PointsToNode *> seen, Killable;
     // This is roughly the mark phase from mark-and-sweep garbage collection. We
     // begin with the roots, which are the arguments of the function,  then
@@ -1113,59 +1604,68 @@ std::set<PointsToNode *> LivenessPointsTo::getKillableDeclaration(const CallInst
 
     // Arguments are roots.
     for (Value *V : CI->arg_operands())
-        insertReachable(factory.getNode(V));
+        insertReachable(getNode(V));
 
     return Killable;
 }
 
-std::pair<LivenessSet, PointsToRelation> LivenessPointsTo::getCalledFunctionResult(const CallString &CS, const Function *F) {
-    std::pair<LivenessSet, PointsToRelation> Result;
+std::pair<const LivenessSet *, const PointsToRelation *> LivenessPointsTo::getCalledFunctionResult(const CallString &CS, const Function *F) {
     // If there is an exact match for F and CS in data, then this should be used.
     // Otherwise, we should use the data that is associated with the function
     // and longest possible prefix of the call string. If there is no data for F
     // at all, just return false.
-
+    auto Empty = std::make_pair(data.getEmptyLivenessSet(), data.getEmptyRelation());
     if (!data.hasDataForFunction(F))
-        return Result;
+        return Empty;
 
     IntraproceduralPointsTo *PT = data.get(F, CS);
     if (PT == nullptr)
-        return Result;
-    auto FirstInst = inst_begin(F);
-    assert(FirstInst != inst_end(F));
-    auto I = PT->find(&*FirstInst);
-    Result.first = *I->second.first;
+        return Empty;
+
+    // The facts are interned, so the summary is still valid if the facts at
+    // the first instruction and at the returns are the same objects as when
+    // it was made.
+    const FunctionInfo &Info = getInfo(F);
+    const LivenessSet *Lin = PT->find(Info.First)->second.first;
+    CalleeSummary &Summary = calleeSummaries[PT];
+    bool valid = Summary.Lin == Lin && Summary.Aouts.size() == Info.Returns.size();
+    for (unsigned i = 0; valid && i < Info.Returns.size(); i++)
+        valid = Summary.Aouts[i] == PT->find(Info.Returns[i])->second.second;
+    if (valid)
+        return std::make_pair(Summary.Lin, Summary.Aout);
 
     // For Aout, we need to union over all of the PointsToRelations associated
     // with ReturnInsts.
+    Summary.Lin = Lin;
+    Summary.Aouts.clear();
     PointsToRelation aout;
-    for (auto I = inst_begin(F), E = inst_end(F); I != E; ++I) {
-        const Instruction *Inst = &*I;
-        if (isa<ReturnInst>(Inst)) {
-            auto J = PT->find(Inst);
-            aout.insertAll(*J->second.second);
-        }
+    for (const ReturnInst *I : Info.Returns) {
+        const PointsToRelation *R = PT->find(I)->second.second;
+        Summary.Aouts.push_back(R);
+        aout.insertAll(*R);
     }
-    Result.second = aout;
+    Summary.Aout = data.intern(aout);
 
-    return Result;
+    return std::make_pair(Summary.Lin, Summary.Aout);
 }
 
-std::set<PointsToNode *> LivenessPointsTo::getReturnValues(const Function *F) {
-    std::set<PointsToNode *> s;
-    for (auto I = inst_begin(F), E = inst_end(F); I != E; ++I)
-    {
-        const Instruction* Inst = &*I;
-        if (const ReturnInst *RI = dyn_cast<ReturnInst>(Inst))
-            if (RI->getReturnValue() != nullptr)
-                s.insert(factory.getNode(RI->getReturnValue()));
-    }
-    return s;
+const FunctionInfo &LivenessPointsTo::getInfo(const Function *F) {
+    auto Existing = infos.find(F);
+    if (Existing != infos.end())
+        return *Existing->second;
+
+    FunctionInfo *Info = new (infoAllocator.Allocate()) FunctionInfo(F, factory);
+    infos.insert(std::make_pair(F, Info));
+    return *Info;
+}
+
+const std::set<PointsToNode *> &LivenessPointsTo::getReturnValues(const Function *F) {
+    return getInfo(F).ReturnValues;
 }
 
 
-LivenessSet LivenessPointsTo::computeFunctionExitLiveness(const CallInst *CI, LivenessSet *Lout) {
-    PointsToNode *CINode = factory.getNode(CI);
+LivenessSet LivenessPointsTo::computeFunctionExitLiveness(const CallInst *CI, const LivenessSet *Lout) {
+    PointsToNode *CINode = getNode(CI);
 
     LivenessSet L;
     for (PointsToNode *N : *Lout) {
@@ -1182,24 +1682,24 @@ LivenessSet LivenessPointsTo::computeFunctionExitLiveness(const CallInst *CI, Li
     // Lin from RemovedActualArguments later.
     // FIXME: What about varargs?
     for (Value *V : CI->arg_operands()) {
-        PointsToNode *ArgNode = factory.getNode(V);
-        if (L.find(ArgNode) != L.end())
+        PointsToNode *ArgNode = getNode(V);
+        if (L.count(ArgNode))
             L.erase(ArgNode);
     }
 
     return L;
 }
 
-PointsToRelation LivenessPointsTo::replaceActualArgumentsWithFormal(const Function *Callee, const CallInst *CI, PointsToRelation *Ain) {
+PointsToRelation LivenessPointsTo::replaceActualArgumentsWithFormal(const Function *Callee, const CallInst *CI, const PointsToRelation *Ain) {
     SmallVector<std::pair<PointsToNode *, PointsToNode *>, 8> ArgMap;
     auto Arg = Callee->arg_begin();
     PointsToRelation R;
     for (Value *V : CI->arg_operands()) {
-        PointsToNode *Node = factory.getNode(V);
+        PointsToNode *Node = getNode(V);
         // FIXME: What about varargs functions?
         assert(Arg != Callee->arg_end() && "Argument count mismatch");
         const Argument *A = &*Arg;
-        PointsToNode *ANode = factory.getNode(A);
+        PointsToNode *ANode = getNode(A);
 
         ArgMap.push_back({Node, ANode});
         if (Node->singlePointee()) {
@@ -1225,7 +1725,7 @@ PointsToRelation LivenessPointsTo::replaceActualArgumentsWithFormal(const Functi
     return R;
 }
 
-LivenessSet LivenessPointsTo::replaceFormalArgumentsWithActual(const CallString &CS, const Function *Callee, const CallInst *CI, LivenessSet &CalledFunctionLin, LivenessSet &Relevant) {
+LivenessSet LivenessPointsTo::replaceFormalArgumentsWithActual(const CallString &CS, const Function *Callee, const CallInst *CI, const LivenessSet &CalledFunctionLin, const LivenessSet &Relevant) {
     LivenessSet L;
     bool calleeInCallString = CI->getParent()->getParent() == Callee || CS.containsCallIn(Callee);
 
@@ -1246,13 +1746,13 @@ LivenessSet LivenessPointsTo::replaceFormalArgumentsWithActual(const CallString
     // Replace formal arguments with actual arguments.
     auto Arg = Callee->arg_begin();
     for (Value *V : CI->arg_operands()) {
-        PointsToNode *Node = factory.getNode(V);
+        PointsToNode *Node = getNode(V);
         // FIXME: What about varargs functions?
         assert(Arg != Callee->arg_end() && "Argument count mismatch");
         const Argument *A = &*Arg;
-        PointsToNode *ANode = factory.getNode(A);
+        PointsToNode *ANode = getNode(A);
 
-        if (L.find(ANode) != L.end()) {
+        if (L.count(ANode)) {
             L.erase(ANode);
             L.insert(Node);
         }
@@ -1262,22 +1762,22 @@ LivenessSet LivenessPointsTo::replaceFormalArgumentsWithActual(const CallString
 
     LivenessSet L2;
     for (PointsToNode *N : L)
-        if (Relevant.find(N) != Relevant.end())
+        if (Relevant.count(N))
             L2.insert(N);
 
     return L2;
 }
 
-PointsToRelation LivenessPointsTo::replaceReturnValuesWithCallInst(const CallInst *CI, PointsToRelation &Aout, std::set<PointsToNode *> &ReturnValues, LivenessSet &Lout) {
-    PointsToNode *CINode = factory.getNode(CI);
-    bool CINodeLive = Lout.find(CINode) != Lout.end();
+PointsToRelation LivenessPointsTo::replaceReturnValuesWithCallInst(const CallInst *CI, const PointsToRelation &Aout, const std::set<PointsToNode *> &ReturnValues, const LivenessSet &Lout) {
+    PointsToNode *CINode = getNode(CI);
+    bool CINodeLive = Lout.count(CINode);
     PointsToRelation R;
     for (auto I = Aout.begin(), E  = Aout.end(); I != E; ++I) {
         if (ReturnValues.find(I->first) != ReturnValues.end()) {
             if (CINodeLive)
                 R.insert(makePointsToPair(CINode, I->second));
         }
-        else if (Lout.find(I->first) != Lout.end())
+        else if (Lout.count(I->first))
             R.insert(*I);
     }
     if (CINodeLive) {
@@ -1291,117 +1791,98 @@ PointsToRelation LivenessPointsTo::replaceReturnValuesWithCallInst(const CallIns
     return R;
 }
 
-void LivenessPointsTo::runOnFunction(const Function *F, const CallString &CS, IntraproceduralPointsTo *Result, PointsToRelation &EntryPointsTo, LivenessSet &ExitLiveness, bool MakeReturnValuesLive, SmallVector<std::tuple<const CallInst *, const Function *, PointsToRelation, LivenessSet, bool>, 8> &Calls) {
-    timesRanOnFunction++;
-    assert(!F->isDeclaration() && "Can only run on definitions.");
+void LivenessPointsTo::initializeNonResult(const Function *F, const Instruction *I, const PointsToRelation *EntryPointsTo, const LivenessSet *ExitLiveness, bool MakeReturnValuesLive, IntraproceduralPointsTo &NonResult) {
+    // If the instruction is a ReturnInst, the values that are live after the
+    // instruction is executed are exactly those specified in ExitLiveness, if
+    // it exists. If the instruction is the first in the function, the
+    // points-to information before it is executed is exactly that in
+    // EntryPointsTo.
+    const LivenessSet *L = data.getEmptyLivenessSet();
+    const PointsToRelation *R = data.getEmptyRelation();
+    if (const ReturnInst *RI = dyn_cast<ReturnInst>(I)) {
+        L = ExitLiveness;
+        if (RI->getReturnValue() != nullptr && MakeReturnValuesLive) {
+            LivenessSet l = *ExitLiveness;
+            l.insert(getNode(RI->getReturnValue()));
+            L = data.intern(l);
+        }
+    }
+    if (I == &*inst_begin(F))
+        R = EntryPointsTo;
+    NonResult.insert({I, {L, R}});
+}
 
-    // The result of the function is lin and aout (since liveness is propagated
-    // backwards and points-to forwards); this variable contains lout and ain.
-    IntraproceduralPointsTo nonresult;
+const InstructionGraph &LivenessPointsTo::getGraph(const Function *F) {
+    auto Existing = graphs.find(F);
+    if (Existing != graphs.end())
+        return *Existing->second;
 
-    // Initialize ain, aout, lin and lout for each instruction, and ensure that
-    // GEPs are handled correctly.
-    for (const_inst_iterator S = inst_begin(F), I = S, E = inst_end(F); I != E; ++I) {
-        const Instruction *inst = &*I;
-
-        // If the instruction is a ReturnInst, the values that are live after
-        // the instruction is executed are exactly those specified in
-        // ExitLiveness, if it exists. If the instruction is the first in the
-        // function, the points-to information before it is executed is exactly
-        // that in EntryPointsTo.
-
-        if (const ReturnInst *RI = dyn_cast<ReturnInst>(inst)) {
-            LivenessSet *L = new LivenessSet();
-            L->insertAll(ExitLiveness);
-            if (RI->getReturnValue() != nullptr && MakeReturnValuesLive)
-                L->insert(factory.getNode(RI->getReturnValue()));
-
-            if (I == S) {
-                PointsToRelation *R = new PointsToRelation();
-                R->insertAll(EntryPointsTo);
-                nonresult.insert({inst, {L, R}});
-            }
-            else
-                nonresult.insert({inst, {L, new PointsToRelation()}});
-        }
-        else if (I == S) {
-            PointsToRelation *R = new PointsToRelation();
-            R->insertAll(EntryPointsTo);
-            nonresult.insert({inst, {new LivenessSet(), R}});
-        }
-        else
-            nonresult.insert({inst, {new LivenessSet(), new PointsToRelation()}});
+    InstructionGraph *G = new (graphAllocator.Allocate()) InstructionGraph(F);
+    graphs.insert(std::make_pair(F, G));
+    return *G;
+}
 
-        if (const GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(inst)) {
-            // If some GEPs which are based on a pointer have all constant
-            // indices and some have none-constant indices, then we want to
-            // treat all of the GEPs based on that pointer field-insensitively.
-            // To ensure that this happens, we ensure that a summary node for
-            // the pointer is created before any of the GEPs with constant
-            // indices are looked at.
-            if (!GEP->hasAllConstantIndices())
-                factory.getNode(GEP);
+void fillSkippedInstructions(const InstructionGraph &G, const BasicBlock *BB, IntraproceduralPointsTo &Result, const IntraproceduralPointsTo &NonResult) {
+    // A skipped instruction doesn't change anything, so its Lin is the Lin of
+    // the next instruction in the graph, and its Aout is that instruction's
+    // Ain. The terminator is never skipped.
+    const Instruction *Next = nullptr;
+    for (auto I = BB->rbegin(), E = BB->rend(); I != E; ++I) {
+        if (G.contains(&*I)) {
+            Next = &*I;
+            continue;
         }
-    }
 
-    // Create and initialize worklist. Also initialize the values of Lout and
-    // Ain, since they are not preserved across calls.
-    SmallPtrSet<const Instruction *, 128> worklist;
-    for (const_inst_iterator I = inst_begin(F), E = inst_end(F); I != E; I++) {
-        worklist.insert(&*I);
-        auto instruction_nonresult = nonresult.find(&*I), instruction_result = Result->find(&*I);
-        assert (instruction_nonresult != nonresult.end());
-        assert (instruction_result != Result->end());
-        auto instruction_ain = instruction_nonresult->second.second;
-        auto instruction_lin = instruction_result->second.first,
-             instruction_lout = instruction_nonresult->second.first;
-        computeLout(&*I, *instruction_lout, *Result);
-        computeAin(&*I, F, *instruction_ain, *instruction_lin, Result, CS.isEmpty());
+        Result[&*I] = std::make_pair(Result.find(Next)->second.first, NonResult.find(Next)->second.second);
     }
+}
 
-    // Update points-to and liveness information until it converges.
-    while (!worklist.empty()) {
-        worklistIterations++;
+void LivenessPointsTo::solve(const Function *F, const CallString &CS, const InstructionGraph &G, IntraproceduralPointsTo *Result, IntraproceduralPointsTo &NonResult, Worklist<Instruction> &Worklist) {
+    // Update points-to and liveness information until it converges. The
+    // counter is shared between threads, so it is only updated at the end.
+    unsigned iterations = 0;
+    while (!Worklist.empty()) {
+        iterations++;
 
-        auto II = worklist.begin();
-        const Instruction *I = *II;
-        worklist.erase(I);
+        const Instruction *I = Worklist.pop();
 
-        auto instruction_nonresult = nonresult.find(I), instruction_result = Result->find(I);
-        assert (instruction_nonresult != nonresult.end());
+        auto instruction_nonresult = NonResult.find(I), instruction_result = Result->find(I);
+        assert (instruction_nonresult != NonResult.end());
         assert (instruction_result != Result->end());
-        auto instruction_ain = instruction_nonresult->second.second,
-             instruction_aout = instruction_result->second.second;
-        auto instruction_lin = instruction_result->second.first,
-             instruction_lout = instruction_nonresult->second.first;
-
-        computeLout(I, *instruction_lout, *Result);
+        // These are references to the entries of the maps, so the updates made
+        // by the compute functions are stored directly.
+        auto &instruction_ain = instruction_nonresult->second.second;
+        auto &instruction_aout = instruction_result->second.second;
+        auto &instruction_lin = instruction_result->second.first;
+        auto &instruction_lout = instruction_nonresult->second.first;
+
+        computeLout(I, G, instruction_lout, *Result);
         // Aout depends on Lout, so this call needs to happen after computeLout
         // (or the current instruction should be added to the worklist when
         // computeLout returns true).
-        bool addSuccsToWorklist = computeAout(CS, I, *instruction_ain, *instruction_aout, *instruction_lout);
+        bool addSuccsToWorklist = computeAout(CS, I, *instruction_ain, instruction_aout, *instruction_lout);
         // Lin depends on Lout, so this call needs to happen after computeLout
         // (or the current instruction should be added to the worklist when
         // computeLout returns true).
-        bool addPredsToWorklist = computeLin(CS, I, *instruction_ain, *instruction_lin, *instruction_lout);
+        bool addPredsToWorklist = computeLin(CS, I, *instruction_ain, instruction_lin, *instruction_lout);
         // Ain depends on Lin, so this call needs to happen after computeLin
         // (or the current instruction should be added to the worklist when
         // computeLin returns true).
-        bool addCurrToWorklist = computeAin(I, F, *instruction_ain, *instruction_lin, Result, CS.isEmpty());
+        bool addCurrToWorklist = computeAin(I, F, G, instruction_ain, instruction_lin, Result, CS.isEmpty());
 
         // Add succs to worklist
         if (addSuccsToWorklist) {
             if (const TerminatorInst *TI = dyn_cast<TerminatorInst>(I)) {
                 for (unsigned i = 0; i < TI->getNumSuccessors(); i++)
-                    worklist.insert(TI->getSuccessor(i)->begin());
+                    Worklist.pushForward(TI->getSuccessor(i)->begin());
             }
             else
-                worklist.insert(getNextInstruction(I));
+                Worklist.pushForward(G.getNext(I));
         }
 
         // Add current instruction to worklist
         if (addCurrToWorklist)
-            worklist.insert(I);
+            Worklist.pushForward(I);
 
         // Add preds to worklist
         if (addPredsToWorklist) {
@@ -1412,11 +1893,241 @@ void LivenessPointsTo::runOnFunction(const Function *F, const CallString &CS, In
                      PI != E;
                      ++PI) {
                     const BasicBlock *Pred = *PI;
-                    worklist.insert(--(Pred->end()));
+                    Worklist.pushBackward(--(Pred->end()));
                 }
             }
             else
-                worklist.insert(getPreviousInstruction(I));
+                Worklist.pushBackward(G.getPrevious(I));
+        }
+    }
+
+    worklistIterations += iterations;
+}
+
+void LivenessPointsTo::solveBlock(const Function *F, const CallString &CS, const BasicBlock *BB, const IntraproceduralPointsTo *Result, const PointsToRelation *EntryPointsTo, const LivenessSet *ExitLiveness, bool MakeReturnValuesLive, IntraproceduralPointsTo &Local, IntraproceduralPointsTo &NonResult) {
+    // The information at the boundaries of the neighbouring blocks is
+    // constant while the block is solved, so it is copied into Local. If the
+    // block is its own neighbour, then the information is computed instead.
+    const TerminatorInst *TI = BB->getTerminator();
+    for (unsigned i = 0; i < TI->getNumSuccessors(); i++) {
+        const BasicBlock *Succ = TI->getSuccessor(i);
+        if (Succ != BB)
+            Local.insert(*Result->find(&Succ->front()));
+    }
+    for (const_pred_iterator PI = pred_begin(BB), E = pred_end(BB); PI != E; ++PI) {
+        const BasicBlock *Pred = *PI;
+        if (Pred != BB)
+            Local.insert(*Result->find(Pred->getTerminator()));
+    }
+
+    const InstructionGraph &G = getGraph(F);
+    ArrayRef<const Instruction *> Instructions = G.getInstructions(BB);
+    for (const Instruction *I : Instructions) {
+        Local.insert({I, {data.getEmptyLivenessSet(), data.getEmptyRelation()}});
+        initializeNonResult(F, I, EntryPointsTo, ExitLiveness, MakeReturnValuesLive, NonResult);
+    }
+
+    // Instructions outside the block aren't in the order, so they are never
+    // added to the worklist.
+    Worklist<Instruction> worklist(Instructions, WorklistOrder);
+    for (const Instruction *I : Instructions) {
+        worklist.pushBackward(I);
+        auto &instruction_nonresult = NonResult.find(I)->second;
+        computeLout(I, G, instruction_nonresult.first, Local);
+        computeAin(I, F, G, instruction_nonresult.second, Local.find(I)->second.first, &Local, CS.isEmpty());
+    }
+
+    solve(F, CS, G, &Local, NonResult, worklist);
+    fillSkippedInstructions(G, BB, Local, NonResult);
+}
+
+void LivenessPointsTo::addCalls(const CallString &CS, const CallInst *CI, const PointsToRelation *Ain, const LivenessSet *Lout, SmallVector<std::tuple<const CallInst *, const Function *, PointsToRelation, LivenessSet, bool>, 8> &Calls) {
+    PointsToNode *CINode = getNode(CI);
+    SmallVector<const Function *, 8> CalledFunctions;
+    bool pointsToUnknown = getCalledFunctions(CalledFunctions, CI, *Ain);
+
+    if (!pointsToUnknown) {
+        for (const Function *Called : CalledFunctions) {
+            if (!Called->isDeclaration()) {
+                // Add to the list of calls made by the function for analysis later.
+                auto EntryPT = replaceActualArgumentsWithFormal(Called, CI, Ain);
+                auto ExitL = computeFunctionExitLiveness(CI, Lout);
+                bool RVL = Lout->count(CINode);
+
+                Calls.push_back(std::make_tuple(CI, Called, EntryPT, ExitL, RVL));
+            }
+        }
+    }
+}
+
+void prepareGEPNodes(const Function *F, PointsToNodeFactory &Factory) {
+    for (const_inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+        if (const GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(&*I)) {
+            // If some GEPs which are based on a pointer have all constant
+            // indices and some have none-constant indices, then we want to
+            // treat all of the GEPs based on that pointer field-insensitively.
+            // To ensure that this happens, we ensure that a summary node for
+            // the pointer is created before any of the GEPs with constant
+            // indices are looked at.
+            if (!GEP->hasAllConstantIndices())
+                Factory.getNode(GEP);
+        }
+    }
+}
+
+// Creates the nodes of all of the GEPs in F, including those of GEP
+// operators used by its instructions, so that the nodes which they make
+// field-insensitive or summary nodes are marked before the analysis starts.
+// The GEPs that are never treated field-sensitively are looked at first, as
+// prepareGEPNodes does.
+void prepareAllGEPNodes(const Function *F, PointsToNodeFactory &Factory) {
+    SmallVector<const GEPOperator *, 16> GEPs;
+    for (const_inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+        if (const GEPOperator *GEP = dyn_cast<GEPOperator>(&*I))
+            GEPs.push_back(GEP);
+        for (const Value *Op : I->operands())
+            if (const GEPOperator *GEP = dyn_cast<GEPOperator>(Op))
+                GEPs.push_back(GEP);
+    }
+
+    SmallVector<const GEPOperator *, 16> FieldSensitive;
+    for (const GEPOperator *GEP : GEPs) {
+        if (GEP->hasIndices() && GEP->hasAllConstantIndices() && cast<ConstantInt>(GEP->idx_begin())->isZero())
+            FieldSensitive.push_back(GEP);
+        else
+            Factory.getNode(GEP);
+    }
+    for (const GEPOperator *GEP : FieldSensitive)
+        Factory.getNode(GEP);
+}
+
+void LivenessPointsTo::runOnFunction(const Function *F, const CallString &CS, IntraproceduralPointsTo *Result, PointsToRelation &EntryPointsTo, LivenessSet &ExitLiveness, bool MakeReturnValuesLive, SmallVector<std::tuple<const CallInst *, const Function *, PointsToRelation, LivenessSet, bool>, 8> &Calls) {
+    timesRanOnFunction++;
+    assert(!F->isDeclaration() && "Can only run on definitions.");
+
+    if (BlockLevel) {
+        runOnFunctionBlocks(F, CS, Result, EntryPointsTo, ExitLiveness, MakeReturnValuesLive, Calls);
+        return;
+    }
+
+    const PointsToRelation *EntryPT = data.intern(EntryPointsTo);
+    const LivenessSet *ExitL = data.intern(ExitLiveness);
+
+    // The result of the function is lin and aout (since liveness is propagated
+    // backwards and points-to forwards); this variable contains lout and ain.
+    IntraproceduralPointsTo nonresult;
+
+    // Only the instructions that can change the information are solved; the
+    // information at the others is filled in afterwards.
+    const InstructionGraph &G = getGraph(F);
+
+    // Initialize ain and lout for each instruction, and ensure that GEPs are
+    // handled correctly.
+    for (const Instruction *I : G.getOrder())
+        initializeNonResult(F, I, EntryPT, ExitL, MakeReturnValuesLive, nonresult);
+    prepareGEPNodes(F, factory);
+
+    // Create and initialize worklist. Also initialize the values of Lout and
+    // Ain, since they are not preserved across calls.
+    Worklist<Instruction> worklist(G.getOrder(), WorklistOrder);
+    for (const Instruction *I : G.getOrder()) {
+        worklist.pushBackward(I);
+        auto instruction_nonresult = nonresult.find(I), instruction_result = Result->find(I);
+        assert (instruction_nonresult != nonresult.end());
+        assert (instruction_result != Result->end());
+        auto &instruction_ain = instruction_nonresult->second.second;
+        auto instruction_lin = instruction_result->second.first;
+        auto &instruction_lout = instruction_nonresult->second.first;
+        computeLout(I, G, instruction_lout, *Result);
+        computeAin(I, F, G, instruction_ain, instruction_lin, Result, CS.isEmpty());
+    }
+
+    while (true) {
+        solve(F, CS, G, Result, nonresult, worklist);
+
+        if (!createdSummaryNode)
+            break;
+
+        createdSummaryNode = false;
+        // Need to rerun on calls even if the data passed to them has not
+        // changed. For the same reason, results at earlier fixed points may no
+        // longer be valid.
+        callData.clear();
+        valueContexts.clear();
+        // We need to rerun on stores because they might need to treat a
+        // summary node differently.
+        for (const StoreInst *SI : getInfo(F).Stores)
+            worklist.pushForward(SI);
+    }
+
+    for (const BasicBlock &BB : *F)
+        fillSkippedInstructions(G, &BB, *Result, nonresult);
+
+    // Determine the boundary information to use when running the analysis on
+    // the called functions.
+    for (const CallInst *CI : getInfo(F).Calls) {
+        auto instruction_nonresult = nonresult.find(CI);
+        assert (instruction_nonresult != nonresult.end());
+        addCalls(CS, CI, instruction_nonresult->second.second, instruction_nonresult->second.first, Calls);
+    }
+}
+
+void mergeBoundary(PointsToData &Data, std::pair<const LivenessSet *, const PointsToRelation *> &Stored, const std::pair<const LivenessSet *, const PointsToRelation *> &Computed, bool &LinChanged, bool &AoutChanged) {
+    // The blocks are solved from scratch, so the new information is joined
+    // with the old information to ensure that it never shrinks.
+    if (Computed.first != Stored.first) {
+        LivenessSet l = *Stored.first;
+        l.insertAll(*Computed.first);
+        const LivenessSet *L = Data.intern(l);
+        LinChanged |= L != Stored.first;
+        Stored.first = L;
+    }
+    if (Computed.second != Stored.second) {
+        PointsToRelation r = *Stored.second;
+        r.insertAll(*Computed.second);
+        const PointsToRelation *R = Data.intern(r);
+        AoutChanged |= R != Stored.second;
+        Stored.second = R;
+    }
+}
+
+void LivenessPointsTo::runOnFunctionBlocks(const Function *F, const CallString &CS, IntraproceduralPointsTo *Result, PointsToRelation &EntryPointsTo, LivenessSet &ExitLiveness, bool MakeReturnValuesLive, SmallVector<std::tuple<const CallInst *, const Function *, PointsToRelation, LivenessSet, bool>, 8> &Calls) {
+    // Only the information at the first instruction and the terminator of
+    // each block is kept in Result. The information at the other instructions
+    // is computed by solving the block locally when it is needed.
+    const PointsToRelation *EntryPT = data.intern(EntryPointsTo);
+    const LivenessSet *ExitL = data.intern(ExitLiveness);
+    prepareGEPNodes(F, factory);
+
+    const FunctionInfo &Info = getInfo(F);
+    Worklist<BasicBlock> worklist(Info.Blocks, WorklistOrder);
+    for (const BasicBlock &BB : *F)
+        worklist.pushBackward(&BB);
+
+    while (!worklist.empty()) {
+        const BasicBlock *BB = worklist.pop();
+
+        IntraproceduralPointsTo local, nonresult;
+        solveBlock(F, CS, BB, Result, EntryPT, ExitL, MakeReturnValuesLive, local, nonresult);
+
+        // Lin at the first instruction is used by the predecessors, and aout
+        // at the terminator is used by the successors.
+        bool linChanged = false, aoutChanged = false, unused = false;
+        const Instruction *First = &BB->front(), *Last = BB->getTerminator();
+        if (First == Last)
+            mergeBoundary(data, Result->find(First)->second, local.find(First)->second, linChanged, aoutChanged);
+        else {
+            mergeBoundary(data, Result->find(First)->second, local.find(First)->second, linChanged, unused);
+            mergeBoundary(data, Result->find(Last)->second, local.find(Last)->second, unused, aoutChanged);
+        }
+
+        if (linChanged)
+            for (const_pred_iterator PI = pred_begin(BB), E = pred_end(BB); PI != E; ++PI)
+                worklist.pushBackward(*PI);
+        if (aoutChanged) {
+            const TerminatorInst *TI = BB->getTerminator();
+            for (unsigned i = 0; i < TI->getNumSuccessors(); i++)
+                worklist.pushForward(TI->getSuccessor(i));
         }
 
         if (worklist.empty() && createdSummaryNode) {
@@ -1424,53 +2135,101 @@ void LivenessPointsTo::runOnFunction(const Function *F, const CallString &CS, In
             // Need to rerun on calls even if the data passed to them has not
             // changed.
             callData.clear();
+            valueContexts.clear();
             // We need to rerun on stores because they might need to treat a
             // summary node differently.
-            for (const_inst_iterator I = inst_begin(F), E = inst_end(F); I != E; I++)
-                if (isa<StoreInst>(*I))
-                    worklist.insert(&*I);
+            for (const StoreInst *SI : Info.Stores)
+                worklist.pushForward(SI->getParent());
         }
     }
 
     // Determine the boundary information to use when running the analysis on
-    // the called functions.
-    for (auto I = inst_begin(F), E = inst_end(F); I != E; ++I) {
-        if (const CallInst *CI = dyn_cast<CallInst>(&*I)) {
-            auto instruction_nonresult = nonresult.find(CI);
-            assert (instruction_nonresult != nonresult.end());
-            auto Ain = instruction_nonresult->second.second;
-
-            PointsToNode *CINode = factory.getNode(CI);
-            CallString newCS = CS.addCallSite(&*I);
-            SmallVector<const Function *, 8> CalledFunctions;
-            bool pointsToUnknown = getCalledFunctions(CalledFunctions, CI, *Ain);
-
-            if (!pointsToUnknown) {
-                for (const Function *Called : CalledFunctions) {
-                    if (!Called->isDeclaration()) {
-                        auto instruction_nonresult = nonresult.find(&*I);
-                        assert (instruction_nonresult != nonresult.end());
-                        auto instruction_ain = instruction_nonresult->second.second;
-                        auto instruction_lout = instruction_nonresult->second.first;
-
-                        // Add to the list of calls made by the function for analysis later.
-                        auto EntryPT = replaceActualArgumentsWithFormal(Called, CI, instruction_ain);
-                        auto ExitL = computeFunctionExitLiveness(CI, instruction_lout);
-                        bool RVL = instruction_lout->find(CINode) != instruction_lout->end();
-
-                        Calls.push_back(std::make_tuple(CI, Called, EntryPT, ExitL, RVL));
-                    }
-                }
-            }
+    // the called functions, which requires the information inside the blocks.
+    // The calls of each block are contiguous, so each block is solved once.
+    IntraproceduralPointsTo local, nonresult;
+    const BasicBlock *solved = nullptr;
+    for (const CallInst *CI : Info.Calls) {
+        if (CI->getParent() != solved) {
+            solved = CI->getParent();
+            local.clear();
+            nonresult.clear();
+            solveBlock(F, CS, solved, Result, EntryPT, ExitL, MakeReturnValuesLive, local, nonresult);
         }
+        auto instruction_nonresult = nonresult.find(CI);
+        addCalls(CS, CI, instruction_nonresult->second.second, instruction_nonresult->second.first, Calls);
     }
 
-    for (auto P : nonresult) {
-        LivenessSet *L = P.second.first;
-        PointsToRelation *R = P.second.second;
-        delete L;
-        delete R;
+    blockLevelResults.erase(Result);
+    blockLevelResults.insert(std::make_pair(Result, std::make_tuple(CS, EntryPT, ExitL, MakeReturnValuesLive)));
+}
+
+bool LivenessPointsTo::materializeResult(const Function *F, IntraproceduralPointsTo *Result) {
+    auto Context = blockLevelResults.find(Result);
+    if (Context == blockLevelResults.end())
+        return true;
+
+    // The blocks are solved from the information at their neighbours'
+    // boundaries, which blocks added after the analysis ran don't have.
+    for (const BasicBlock &BB : *F)
+        if (!Result->count(&BB.front()) || !Result->count(BB.getTerminator()))
+            return false;
+
+    const CallString &CS = std::get<0>(Context->second);
+    for (const BasicBlock &BB : *F) {
+        IntraproceduralPointsTo local, nonresult;
+        solveBlock(F, CS, &BB, Result, std::get<1>(Context->second), std::get<2>(Context->second), std::get<3>(Context->second), local, nonresult);
+        for (const Instruction &I : BB) {
+            if (isBlockBoundary(&I))
+                continue;
+            // Instructions added after the analysis ran have no results.
+            auto Found = local.find(&I);
+            if (Found != local.end())
+                (*Result)[&I] = Found->second;
+        }
     }
+
+    blockLevelResults.erase(Context);
+    return true;
+}
+
+void LivenessPointsTo::materialize(const Function &F) {
+    if (!data.hasDataForFunction(&F))
+        return;
+
+    ProcedurePointsTo *P = data.getAtFunction(&F);
+    for (auto &E : *P)
+        materializeResult(&F, std::get<1>(E));
+}
+
+CallString LivenessPointsTo::extendCallString(const CallString &CS, const Instruction *I) {
+    auto Key = std::make_pair(CS.getKey(), I);
+    auto Cached = extendedCallStrings.find(Key);
+    if (Cached != extendedCallStrings.end())
+        return Cached->second;
+
+    CallString Extended = CS;
+    if (CallStringLimit == 0 || CS.size() < (int)CallStringLimit)
+        Extended = CS.addCallSite(I);
+    else
+        Extended = CS.getSummary();
+    extendedCallStrings.insert(std::make_pair(Key, Extended));
+    return Extended;
+}
+
+bool LivenessPointsTo::joinSummaryBoundary(const CallString &CS, const Function *F, PointsToRelation &EntryPointsTo, LivenessSet &ExitLiveness, bool &MakeReturnValuesLive) {
+    auto Inserted = summaryBoundaries.insert(std::make_pair(std::make_pair(CS.getKey(), F), std::make_tuple(data.intern(EntryPointsTo), data.intern(ExitLiveness), MakeReturnValuesLive)));
+    if (Inserted.second)
+        return true;
+
+    auto &Joined = Inserted.first->second;
+    EntryPointsTo.insertAll(*std::get<0>(Joined));
+    ExitLiveness.insertAll(*std::get<1>(Joined));
+    MakeReturnValuesLive |= std::get<2>(Joined);
+    auto New = std::make_tuple(data.intern(EntryPointsTo), data.intern(ExitLiveness), MakeReturnValuesLive);
+    if (New == Joined)
+        return false;
+    Joined = New;
+    return true;
 }
 
 bool LivenessPointsTo::runOnFunctionAt(const CallString& CS,
@@ -1479,32 +2238,75 @@ bool LivenessPointsTo::runOnFunctionAt(const CallString& CS,
                                        LivenessSet &ExitLiveness,
                                        bool MakeReturnValuesLive,
                                        bool AlwaysRerun) {
+    // A summary context stands for all of the call strings that are longer
+    // than the limit, so it is solved with the join of the boundary
+    // information from all of them. The analysis is monotonic, so its
+    // results are safe for each of them.
+    bool Joined = false, Existed = false;
+    if (CS.isSummary()) {
+        Existed = data.get(F, CS) != nullptr;
+        Joined = joinSummaryBoundary(CS, F, EntryPointsTo, ExitLiveness, MakeReturnValuesLive);
+    }
+
     bool Changed = true;
-    IntraproceduralPointsTo *Out = data.getPointsTo(CS, F, EntryPointsTo, ExitLiveness, Changed);
+    IntraproceduralPointsTo *Out = data.getPointsTo(CS, F, EntryPointsTo, ExitLiveness, BlockLevel, Changed);
+    // The stored boundary information of a summary context is the first that
+    // it was solved with, so it is compared with the join instead.
+    if (CS.isSummary())
+        Changed = Joined || !Existed;
+    if (!unvalidatedKeys.empty() && unvalidatedKeys.erase(std::make_pair(F, CS.getKey()))) {
+        // The context was kept from the last run. If its boundary
+        // information is the same, then so are its results and those of the
+        // contexts below it. Otherwise the information may have shrunk, so
+        // it is solved from scratch.
+        if (!Changed)
+            validated.insert(CS.getKey());
+        else {
+            eraseContext(F, CS);
+            Out = data.getPointsTo(CS, F, EntryPointsTo, ExitLiveness, BlockLevel, Changed);
+        }
+    }
     if (!AlwaysRerun && !Changed) {
         // If the boundary information has not changed since the analysis was
         // last run on this function, then there is no need to run it again.
         return false;
     }
-    IntraproceduralPointsTo Copy = copyPointsToMap(Out);
+    // The facts are interned, so copying the map doesn't copy them.
+    IntraproceduralPointsTo Copy = *Out;
     SmallVector<std::tuple<const CallInst *, const Function *, PointsToRelation, LivenessSet, bool>, 8> Calls;
-    runOnFunction(F, CS, Out, EntryPointsTo, ExitLiveness, MakeReturnValuesLive, Calls);
-
-    bool eq = arePointsToMapsEqual(F, Out, Copy);
 
-    for (auto P : Copy) {
-        LivenessSet *L = P.second.first;
-        PointsToRelation *R = P.second.second;
-        delete L;
-        delete R;
+    ValueContextKey Key;
+    auto Reused = valueContexts.end();
+    // The profile of a summary doesn't determine its summary nodes.
+    bool UseValueContexts = ValueContexts && !CS.isSummary();
+    if (UseValueContexts) {
+        Key = std::make_tuple(F, data.intern(EntryPointsTo), data.intern(ExitLiveness), MakeReturnValuesLive, CS.getProfile());
+        Reused = valueContexts.find(Key);
+    }
+
+    if (Reused != valueContexts.end()) {
+        // The function has reached a fixed point with the same boundary
+        // information at another call string, so it will reach the same one
+        // here. Its calls are still followed as usual, so that the contexts
+        // of the called functions exist for this call string.
+        *Out = Reused->second.first;
+        Calls = Reused->second.second;
+        if (BlockLevel) {
+            blockLevelResults.erase(Out);
+            blockLevelResults.insert(std::make_pair(Out, std::make_tuple(CS, std::get<1>(Key), std::get<2>(Key), MakeReturnValuesLive)));
+        }
     }
+    else
+        runOnFunction(F, CS, Out, EntryPointsTo, ExitLiveness, MakeReturnValuesLive, Calls);
+
+    bool eq = arePointsToMapsEqual(F, Out, Copy);
 
     if (eq) {
         // If there is a prefix with the same information, then make it
         // cyclic. If a cyclic call string is created and then the analysis is
         // rerun with a matching call string, it is removed; this deals with
         // cases where a cyclic call string is created prematurely.
-        if (data.attemptMakeCyclicCallString(F, CS, Out))
+        if (!CS.isSummary() && data.attemptMakeCyclicCallString(F, CS, Out))
             return false;
 
         // If there is no prefix with the same information, then we need to look
@@ -1522,33 +2324,33 @@ bool LivenessPointsTo::runOnFunctionAt(const CallString& CS,
             bool RVL;
             std::tie(I, F, PT, L, RVL) = C;
 
-            CallString newCS = CS.addCallSite(I);
-
-            auto Iter = std::find_if(callData.begin(), callData.end(), [&](std::tuple<CallString, const Function *, PointsToRelation, LivenessSet, bool> D) {
-                CallString CS = std::get<0>(D);
-                const Function *IF = std::get<1>(D);
-                return CS.matches(newCS) && IF == F;
-            });
-
-            if (Iter != callData.end()) {
-                auto LastData = *Iter;
-                PointsToRelation LastPT = std::get<2>(LastData);
-                LivenessSet LastL = std::get<3>(LastData);
-                bool LastRVL = std::get<4>(LastData);
-                if (LastPT == PT && LastL == L && LastRVL == RVL)
+            CallString newCS = extendCallString(CS, I);
+            // The context of the call is merged into the summary, which is
+            // counted once for each call that leads to it.
+            if (newCS.isSummary() && mergedCalls.insert(std::make_pair(CS.getKey(), I)).second)
+                mergedContexts++;
+
+            // The boundary information is interned, so it can be compared
+            // with the information from the last call by pointer.
+            auto NewData = std::make_tuple(data.intern(PT), data.intern(L), RVL);
+            auto Inserted = callData.insert(std::make_pair(std::make_pair(newCS.getKey(), F), NewData));
+            if (!Inserted.second) {
+                if (Inserted.first->second == NewData)
                     continue;
                 else
-                    *Iter = std::make_tuple(newCS, F, PT, L, RVL);
+                    Inserted.first->second = NewData;
             }
-            else
-                callData.push_back(std::make_tuple(newCS, F, PT, L, RVL));
 
             rerun |= runOnFunctionAt(newCS, F, PT, L, RVL, false);
         }
         if (rerun)
             return runOnFunctionAt(CS, F, EntryPointsTo, ExitLiveness, MakeReturnValuesLive, true);
-        else
-            return false;
+
+        // Neither the function nor its callees have changed, so this is a
+        // fixed point.
+        if (UseValueContexts)
+            valueContexts[Key] = std::make_pair(*Out, Calls);
+        return false;
     }
     else {
         // Since the information at the caller depends on the information here,
@@ -1563,13 +2365,420 @@ bool LivenessPointsTo::runOnFunctionAt(const CallString& CS,
     }
 }
 
-void LivenessPointsTo::runOnModule(Module &M) {
-    for (Function &F : M) {
-        if (!F.isDeclaration()) {
-            callData.clear();
-            LivenessSet L;
-            PointsToRelation R;
-            runOnFunctionAt(CallString::empty(), &F, R, L, true, true);
+void LivenessPointsTo::runOnRoot(const Function *F) {
+    callData.clear();
+    LivenessSet L;
+    PointsToRelation R;
+    runOnFunctionAt(CallString::empty(), F, R, L, true, true);
+    // The facts that were superseded while the root was solved can be freed
+    // now that the solver has returned.
+    sweepFacts();
+}
+
+void LivenessPointsTo::sweepFacts() {
+    if (!data.shouldSweep())
+        return;
+
+    // The boundary information of the calls is rebuilt by the next root, and
+    // the restrictions are recomputed when they are needed.
+    callData.clear();
+    restrictions.clear();
+
+    DenseSet<const LivenessSet *> Sets;
+    DenseSet<const PointsToRelation *> Relations;
+    for (auto &R : blockLevelResults) {
+        Relations.insert(std::get<1>(R.second));
+        Sets.insert(std::get<2>(R.second));
+    }
+    for (auto &V : valueContexts) {
+        Relations.insert(std::get<1>(V.first));
+        Sets.insert(std::get<2>(V.first));
+        for (auto &I : V.second.first) {
+            Sets.insert(I.second.first);
+            Relations.insert(I.second.second);
+        }
+    }
+    for (auto &B : summaryBoundaries) {
+        Relations.insert(std::get<0>(B.second));
+        Sets.insert(std::get<1>(B.second));
+    }
+    for (auto &C : calleeSummaries) {
+        Sets.insert(C.second.Lin);
+        for (const PointsToRelation *R : C.second.Aouts)
+            Relations.insert(R);
+        Relations.insert(C.second.Aout);
+    }
+    data.sweep(Sets, Relations);
+
+    // A freed relation's address may be reused by a new one, so the targets
+    // found with it are forgotten.
+    for (auto I = indirectTargets.begin(), E = indirectTargets.end(); I != E;) {
+        auto Current = I++;
+        if (!Relations.count(Current->first.second))
+            indirectTargets.erase(Current);
+    }
+}
+
+void LivenessPointsTo::runOnRootsInParallel(ArrayRef<const Function *> Roots, unsigned NumThreads) {
+    // Each root is analysed from the empty call string, so the contexts that
+    // are created for different roots never have the same call string. Each
+    // thread therefore has its own worker, with its own results and scratch
+    // state; only the nodes and the call string trie are shared. The roots
+    // are handed out one at a time, since they vary a lot in size.
+    //
+    // The nodes are shared, so a worker doesn't change which of them are
+    // summary nodes while the others are running. The nodes of every GEP,
+    // and with them the nodes that the GEPs make field-insensitive or
+    // summary nodes, are created before the round. The nodes that the
+    // workers would make summary nodes are marked after it, in which case
+    // the round is run again from scratch. The results therefore don't
+    // depend on how the threads are scheduled.
+    for (const Function &F : *Roots.front()->getParent())
+        if (!F.isDeclaration())
+            prepareAllGEPNodes(&F, factory);
+
+    std::vector<std::unique_ptr<LivenessPointsTo>> workers;
+    while (true) {
+        std::atomic<unsigned> next(0);
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < NumThreads; i++) {
+            workers.emplace_back(new LivenessPointsTo(factory));
+            LivenessPointsTo *Worker = workers.back().get();
+            threads.emplace_back([Worker, Roots, &next]() {
+                deferredSummaryNodes = &Worker->pendingSummaryNodes;
+                for (unsigned r = next++; r < Roots.size(); r = next++)
+                    Worker->runOnRoot(Roots[r]);
+                deferredSummaryNodes = nullptr;
+            });
+        }
+        for (std::thread &T : threads)
+            T.join();
+
+        bool createdSummaryNodes = false;
+        for (auto &Worker : workers) {
+            for (PointsToNode *N : Worker->pendingSummaryNodes) {
+                if (!N->isAlwaysSummaryNode()) {
+                    N->markAsSummaryNode();
+                    createdSummaryNodes = true;
+                }
+            }
+        }
+        if (!createdSummaryNodes)
+            break;
+        workers.clear();
+    }
+
+    // The results are copied into this analysis, along with the facts that
+    // they refer to, so the workers can be destroyed.
+    for (auto &Worker : workers) {
+        mergedContexts += Worker->mergedContexts;
+        DenseMap<const IntraproceduralPointsTo *, IntraproceduralPointsTo *> Copies;
+        data.merge(Worker->data, Copies);
+        for (auto &R : Worker->blockLevelResults) {
+            // The results of discarded contexts aren't copied.
+            IntraproceduralPointsTo *Copy = Copies.lookup(R.first);
+            if (Copy == nullptr)
+                continue;
+            auto &Boundary = R.second;
+            blockLevelResults.insert(std::make_pair(Copy, std::make_tuple(std::get<0>(Boundary), data.intern(*std::get<1>(Boundary)), data.intern(*std::get<2>(Boundary)), std::get<3>(Boundary))));
+        }
+        for (auto &B : Worker->summaryBoundaries) {
+            auto &Boundary = B.second;
+            summaryBoundaries.insert(std::make_pair(B.first, std::make_tuple(data.intern(*std::get<0>(Boundary)), data.intern(*std::get<1>(Boundary)), std::get<2>(Boundary))));
         }
     }
 }
+
+// Returns true if every use of F is a call to it that the analysis follows.
+static bool hasOnlyDirectCalls(const Function *F) {
+    for (const User *U : F->users()) {
+        const CallInst *CI = dyn_cast<CallInst>(U);
+        if (CI == nullptr || CI->getCalledValue() != F)
+            return false;
+    }
+    return true;
+}
+
+SmallVector<const Function *, 32> findRoots(Module &M) {
+    SmallVector<const Function *, 32> Roots;
+    if (AllRoots) {
+        for (Function &F : M)
+            if (!F.isDeclaration())
+                Roots.push_back(&F);
+        return Roots;
+    }
+
+    // The functions which can be called from outside the module (because
+    // they are externally visible or their address is taken) are called by
+    // the external calling node. Such a function only has to be a root if
+    // the module doesn't reach it through calls that the analysis follows;
+    // otherwise it is analysed in the contexts of its callers, like the
+    // functions that are only called directly. A function that isn't
+    // reachable from a root can't execute.
+    CallGraph CG(M);
+    SmallPtrSet<const CallGraphNode *, 32> Entries;
+    for (auto &Callee : *CG.getExternalCallingNode())
+        Entries.insert(Callee.second);
+
+    // The SCCs are visited top-down, so the callers of an SCC outside it
+    // have been visited before it, and a root is analysed after the roots
+    // that call it, so its callers' contexts for it already exist.
+    std::vector<std::vector<CallGraphNode *>> SCCs;
+    for (scc_iterator<CallGraph *> I = scc_begin(&CG); !I.isAtEnd(); ++I)
+        SCCs.push_back(*I);
+
+    DenseSet<const Function *> Reached;
+    for (auto I = SCCs.rbegin(), E = SCCs.rend(); I != E; ++I) {
+        bool SCCReached = false;
+        for (CallGraphNode *N : *I)
+            SCCReached = SCCReached || Reached.count(N->getFunction());
+
+        for (CallGraphNode *N : *I) {
+            const Function *F = N->getFunction();
+            if (F == nullptr || F->isDeclaration() || !Entries.count(N))
+                continue;
+            // A function whose address is taken may be called from code that
+            // isn't analysed, so it is always a root.
+            if (!SCCReached || !hasOnlyDirectCalls(F)) {
+                Roots.push_back(F);
+                SCCReached = true;
+            }
+        }
+
+        if (!SCCReached)
+            continue;
+        for (CallGraphNode *N : *I) {
+            Reached.insert(N->getFunction());
+            for (auto &Callee : *N)
+                if (const Function *G = Callee.second->getFunction())
+                    Reached.insert(G);
+        }
+    }
+    return Roots;
+}
+
+void LivenessPointsTo::recordFingerprints(Module &M) {
+    fingerprints.clear();
+    for (const Function &F : M)
+        if (!F.isDeclaration())
+            fingerprints.insert(std::make_pair(&F, computeFingerprint(F)));
+}
+
+void LivenessPointsTo::eraseContext(const Function *F, const CallString &CS) {
+    ProcedurePointsTo *P = data.getAtFunction(F);
+    ProcedurePointsTo::Entry *E = P->find(CS);
+    assert(E != nullptr);
+    blockLevelResults.erase(std::get<1>(*E));
+    calleeSummaries.erase(std::get<1>(*E));
+    summaryBoundaries.erase(std::make_pair(CS.getKey(), F));
+    P->erase(CS);
+}
+
+SmallVector<const Function *, 32> LivenessPointsTo::invalidateChangedFunctions(Module &M, ArrayRef<const Function *> Roots) {
+    DenseMap<const Function *, FunctionFingerprint> previous;
+    std::swap(previous, fingerprints);
+    recordFingerprints(M);
+
+    // The functions that have changed or been removed. Their instructions
+    // may have been freed, so nothing may refer to them any more.
+    SmallPtrSet<const Function *, 16> changed;
+    SmallPtrSet<const Instruction *, 32> staleCalls;
+    for (auto &P : previous) {
+        auto Current = fingerprints.find(P.first);
+        if (Current != fingerprints.end() && Current->second.Hash == P.second.Hash)
+            continue;
+        changed.insert(P.first);
+        staleCalls.insert(P.second.CallSites.begin(), P.second.CallSites.end());
+        factory.forget(P.second.Values);
+        graphs.erase(P.first);
+        infos.erase(P.first);
+    }
+    for (auto &P : fingerprints)
+        if (!previous.count(P.first))
+            changed.insert(P.first);
+    if (changed.empty())
+        return SmallVector<const Function *, 32>();
+    CallString::forgetCallSites(staleCalls);
+    clearLookupCaches();
+    // Declarations may have been removed too.
+    libraryModels.clear();
+    indirectTargets.clear();
+    visibleAccesses.clear();
+
+    // The results of a function depend on those of everything that it may
+    // call, so the callers of the changed functions have to be solved again
+    // as well. Indirect calls may call any function whose address is taken.
+    DenseMap<const Function *, SmallVector<const Function *, 4>> callers;
+    SmallVector<const Function *, 8> indirectCallers;
+    for (auto &P : fingerprints) {
+        for (const Function *Callee : P.second.Callees)
+            callers[Callee].push_back(P.first);
+        if (P.second.HasIndirectCalls)
+            indirectCallers.push_back(P.first);
+    }
+    SmallPtrSet<const Function *, 32> dirty;
+    SmallVector<const Function *, 16> worklist;
+    for (const Function *F : changed)
+        if (fingerprints.count(F))
+            worklist.push_back(F);
+    while (!worklist.empty()) {
+        const Function *F = worklist.pop_back_val();
+        if (!dirty.insert(F).second)
+            continue;
+        worklist.append(callers[F].begin(), callers[F].end());
+        if (F->hasAddressTaken())
+            worklist.append(indirectCallers.begin(), indirectCallers.end());
+    }
+
+    SmallPtrSet<const Instruction *, 32> dirtyCalls;
+    for (const Function *F : dirty)
+        dirtyCalls.insert(fingerprints[F].CallSites.begin(), fingerprints[F].CallSites.end());
+
+    // The contexts of the functions that are solved again are discarded,
+    // along with those whose call strings contain calls that may have been
+    // freed. Contexts whose call strings pass through functions that are
+    // solved again are kept until they are reached again.
+    for (auto &P : previous) {
+        const Function *F = P.first;
+        if (!data.hasDataForFunction(F))
+            continue;
+        if (changed.count(F) || dirty.count(F)) {
+            for (const ProcedurePointsTo::Entry &E : *data.getAtFunction(F)) {
+                blockLevelResults.erase(std::get<1>(E));
+                calleeSummaries.erase(std::get<1>(E));
+                summaryBoundaries.erase(std::make_pair(std::get<0>(E).getKey(), F));
+            }
+            data.eraseFunction(F);
+            continue;
+        }
+
+        SmallVector<CallString, 8> discarded;
+        for (const ProcedurePointsTo::Entry &E : *data.getAtFunction(F)) {
+            const CallString &CS = std::get<0>(E);
+            // The boundary information of a summary may come from any of
+            // the calls below its call string, so it can't be validated.
+            if (CS.containsCallSiteIn(staleCalls) || ((CS.isCyclic() || CS.isSummary()) && CS.containsCallSiteIn(dirtyCalls)))
+                discarded.push_back(CS);
+            else if (CS.containsCallSiteIn(dirtyCalls)) {
+                unvalidated.push_back(std::make_pair(F, CS));
+                unvalidatedKeys.insert(std::make_pair(F, CS.getKey()));
+            }
+        }
+        for (const CallString &CS : discarded)
+            eraseContext(F, CS);
+    }
+    for (auto I = valueContexts.begin(); I != valueContexts.end();) {
+        if (dirty.count(std::get<0>(I->first)))
+            I = valueContexts.erase(I);
+        else
+            ++I;
+    }
+
+    // The roots that don't call anything that has changed keep their
+    // results.
+    SmallVector<const Function *, 32> Result;
+    for (const Function *F : Roots)
+        if (dirty.count(F) || !data.hasDataForFunction(F) || data.getAtFunction(F)->find(CallString::empty()) == nullptr)
+            Result.push_back(F);
+    return Result;
+}
+
+void LivenessPointsTo::pruneUnvalidatedContexts() {
+    // Contexts that haven't been reached again may have had their call
+    // strings made cyclic in the meantime, in which case they are gone.
+    for (auto &U : unvalidated)
+        if (unvalidatedKeys.count(std::make_pair(U.first, U.second.getKey())) && !U.second.hasNonCyclicPrefixIn(validated))
+            if (data.getAtFunction(U.first)->find(U.second) != nullptr)
+                eraseContext(U.first, U.second);
+    unvalidated.clear();
+    unvalidatedKeys.clear();
+    validated.clear();
+}
+
+void LivenessPointsTo::prepareOnDemand(Module &M) {
+    // The results in a function only depend on the roots that reach it.
+    pendingRoots.clear();
+    mergedContexts = 0;
+    mergedCalls.clear();
+    SmallVector<const Function *, 32> Roots = findRoots(M);
+    rootOrder.assign(Roots.begin(), Roots.end());
+    pendingRoots.insert(Roots.begin(), Roots.end());
+
+    indirectlyCalling.clear();
+    for (const Function &F : M) {
+        bool HasIndirectCalls = false;
+        for (const BasicBlock &BB : F)
+            for (const Instruction &I : BB)
+                if (const CallInst *CI = dyn_cast<CallInst>(&I))
+                    if (!CI->getCalledFunction())
+                        HasIndirectCalls = true;
+        if (HasIndirectCalls)
+            indirectlyCalling.push_back(&F);
+    }
+}
+
+void LivenessPointsTo::finishOnDemand(Module &M) {
+    for (const Function *F : rootOrder)
+        if (pendingRoots.erase(F))
+            runOnRoot(F);
+}
+
+void LivenessPointsTo::analyseReachingRoots(const Function *F) {
+    if (pendingRoots.empty())
+        return;
+
+    // A function is analysed in the contexts of its callers, so each root
+    // that calls it, directly or through other functions, has to be
+    // analysed before its results are complete. A function whose address
+    // is taken may be called by any indirect call, so the roots that reach
+    // those are needed as well.
+    DenseSet<const Function *> Seen;
+    SmallVector<const Function *, 16> Pending(1, F);
+    while (!Pending.empty()) {
+        const Function *G = Pending.pop_back_val();
+        if (!Seen.insert(G).second)
+            continue;
+        for (const User *U : G->users())
+            if (const CallInst *CI = dyn_cast<CallInst>(U))
+                if (CI->getCalledValue() == G)
+                    Pending.push_back(CI->getParent()->getParent());
+        if (G->hasAddressTaken())
+            Pending.append(indirectlyCalling.begin(), indirectlyCalling.end());
+    }
+
+    // The roots are analysed in the same order as when the whole module is.
+    for (const Function *R : rootOrder)
+        if (Seen.count(R) && pendingRoots.erase(R))
+            runOnRoot(R);
+}
+
+bool LivenessPointsTo::isIncremental() {
+    return Incremental;
+}
+
+void LivenessPointsTo::runOnModule(Module &M) {
+    pendingRoots.clear();
+    mergedContexts = 0;
+    mergedCalls.clear();
+    SmallVector<const Function *, 32> Roots = findRoots(M);
+
+    if (Incremental && !fingerprints.empty()) {
+        // The kept contexts have to be visible to the solver, so the roots
+        // that have to be solved again are solved on this thread.
+        for (const Function *F : invalidateChangedFunctions(M, Roots))
+            runOnRoot(F);
+        pruneUnvalidatedContexts();
+        return;
+    }
+    if (Incremental)
+        recordFingerprints(M);
+
+    unsigned NumThreads = std::min<unsigned>(Threads, Roots.size());
+    if (NumThreads > 1) {
+        runOnRootsInParallel(Roots, NumThreads);
+        return;
+    }
+
+    for (const Function *F : Roots)
+        runOnRoot(F);
+}
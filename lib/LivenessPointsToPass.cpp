@@ -0,0 +1,46 @@
+#include "LivenessPointsToPass.h"
+
+char LivenessPointsToPass::ID = 0;
+static RegisterPass<LivenessPointsToPass> X("lfcpa-points-to", "Liveness-based points-to analysis", false, true);
+
+bool LivenessPointsToPass::runOnModule(Module &M) {
+    module = &M;
+    state = S_Unanalysed;
+    kept = analysis != nullptr;
+    if (!analysis)
+        analysis.reset(new LivenessPointsTo());
+    return false;
+}
+
+void LivenessPointsToPass::getAnalysisUsage(AnalysisUsage &AU) const {
+    AU.setPreservesAll();
+}
+
+void LivenessPointsToPass::releaseMemory() {
+    // The call string trie is only destroyed with the last analysis, so the
+    // old analysis is destroyed before a new one is created.
+    if (!LivenessPointsTo::isIncremental())
+        analysis.reset();
+}
+
+LivenessPointsTo &LivenessPointsToPass::getResult() {
+    assert(analysis && "The pass hasn't been run.");
+    if (state == S_OnDemand)
+        analysis->finishOnDemand(*module);
+    else if (state == S_Unanalysed)
+        analysis->runOnModule(*module);
+    state = S_Analysed;
+    return *analysis;
+}
+
+LivenessPointsTo &LivenessPointsToPass::getResultOnDemand() {
+    assert(analysis && "The pass hasn't been run.");
+    // The results of an earlier run have to be brought up to date first.
+    if (kept)
+        return getResult();
+    if (state == S_Unanalysed) {
+        analysis->prepareOnDemand(*module);
+        state = S_OnDemand;
+    }
+    return *analysis;
+}
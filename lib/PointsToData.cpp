@@ -1,6 +1,9 @@
+#include <algorithm>
+
 #include "llvm/IR/Function.h"
 #include "llvm/IR/InstIterator.h"
 
+#include "LivenessPointsToMisc.h"
 #include "PointsToData.h"
 
 ProcedurePointsTo *PointsToData::getAtFunction(const Function *F) const {
@@ -9,73 +12,208 @@ ProcedurePointsTo *PointsToData::getAtFunction(const Function *F) const {
     return result->second;
 }
 
-bool arePointsToMapsEqual(const Function *F, IntraproceduralPointsTo *a, IntraproceduralPointsTo &b) {
+bool arePointsToMapsEqual(const Function *F, const IntraproceduralPointsTo *a, const IntraproceduralPointsTo &b) {
     for (const_inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
         auto p1 = a->find(&*I), p2 = b.find(&*I);
-        assert(p1 != a->end() && p2 != b.end() && "Invalid points-to relations");
-        LivenessSet *l1 = p1->second.first, *l2 = p2->second.first;
-        if (*l1 != *l2)
-            return false;
-        PointsToRelation *r1 = p1->second.second, *r2 = p2->second.second;
-        if (*r1 != *r2)
+        // If only the information at block boundaries has been kept, then the
+        // other instructions may not have entries. The information at them is
+        // determined by the information at the boundaries.
+        if (p1 == a->end() || p2 == b.end()) {
+            assert(!isBlockBoundary(&*I) && "Invalid points-to relations");
+            continue;
+        }
+        // The sets and relations are interned, so they are equal exactly when
+        // the pointers are.
+        if (p1->second != p2->second)
             return false;
     }
     return true;
 }
 
-IntraproceduralPointsTo copyPointsToMap(IntraproceduralPointsTo *M) {
-    IntraproceduralPointsTo Result;
-    for (auto P : *M) {
-        LivenessSet *L = new LivenessSet(*P.second.first);
-        PointsToRelation *R = new PointsToRelation(*P.second.second);
-        Result.insert(std::make_pair(P.first, std::make_pair(L, R)));
+static void eraseFromBucket(SmallVector<unsigned, 2> &Bucket, unsigned Position) {
+    Bucket.erase(std::find(Bucket.begin(), Bucket.end(), Position));
+}
+
+void ProcedurePointsTo::addToIndex(unsigned Position, const CallString &CS) {
+    byCallString.insert(std::make_pair(CS.getKey(), Position));
+    byLastCall[CS.getLastCall()].push_back(Position);
+    if (const Function *F = CS.getLastCalledFunction())
+        byLastCalledFunction[F].push_back(Position);
+    if (CS.isCyclic())
+        cyclic.push_back(Position);
+}
+
+void ProcedurePointsTo::removeFromIndex(unsigned Position, const CallString &CS) {
+    byCallString.erase(CS.getKey());
+    eraseFromBucket(byLastCall[CS.getLastCall()], Position);
+    if (const Function *F = CS.getLastCalledFunction())
+        eraseFromBucket(byLastCalledFunction[F], Position);
+    if (CS.isCyclic())
+        cyclic.erase(std::find(cyclic.begin(), cyclic.end(), Position));
+}
+
+ProcedurePointsTo::Entry *ProcedurePointsTo::find(const CallString &CS) {
+    auto I = byCallString.find(CS.getKey());
+    if (I == byCallString.end())
+        return nullptr;
+    return &entries.find(I->second)->second;
+}
+
+ProcedurePointsTo::Entry *ProcedurePointsTo::findCyclicMatch(const CallString &CS) {
+    for (unsigned Position : cyclic) {
+        Entry &E = entries.find(Position)->second;
+        if (std::get<0>(E).matches(CS))
+            return &E;
     }
-    return Result;
+    return nullptr;
 }
 
-IntraproceduralPointsTo *PointsToData::getPointsTo(const CallString &CS, const Function *F, PointsToRelation &EntryPT, LivenessSet &ExitL, bool &Changed) {
-    assert (!CS.isCyclic() && "Information has already been computed.");
+SmallVector<ProcedurePointsTo::Entry *, 4> ProcedurePointsTo::findWithSameLastCall(const CallString &CS) {
+    SmallVector<unsigned, 4> positions;
+    auto Empty = byLastCall.find(nullptr);
+    if (Empty != byLastCall.end())
+        for (unsigned Position : Empty->second)
+            if (std::get<0>(entries.find(Position)->second).isEmpty())
+                positions.push_back(Position);
+    if (CS.getLastCall() != nullptr) {
+        auto SameCall = byLastCall.find(CS.getLastCall());
+        if (SameCall != byLastCall.end())
+            positions.append(SameCall->second.begin(), SameCall->second.end());
+    }
+    if (const Function *F = CS.getLastCalledFunction()) {
+        auto SameFunction = byLastCalledFunction.find(F);
+        if (SameFunction != byLastCalledFunction.end())
+            positions.append(SameFunction->second.begin(), SameFunction->second.end());
+    }
+
+    // Positions increase in order of creation.
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+
+    SmallVector<Entry *, 4> result;
+    for (unsigned Position : positions)
+        result.push_back(&entries.find(Position)->second);
+    return result;
+}
+
+void ProcedurePointsTo::insert(const Entry &E) {
+    unsigned Position = nextPosition++;
+    entries.insert(std::make_pair(Position, E));
+    addToIndex(Position, std::get<0>(E));
+}
 
+void ProcedurePointsTo::replace(Entry *Old, const Entry &New) {
+    auto I = byCallString.find(std::get<0>(*Old).getKey());
+    assert(I != byCallString.end() && &entries.find(I->second)->second == Old && "The entry is not in the index.");
+    unsigned Position = I->second;
+    removeFromIndex(Position, std::get<0>(*Old));
+    *Old = New;
+    addToIndex(Position, std::get<0>(New));
+}
+
+void ProcedurePointsTo::erase(const CallString &CS) {
+    auto I = byCallString.find(CS.getKey());
+    assert(I != byCallString.end() && "The call string is not in the index.");
+    unsigned Position = I->second;
+    removeFromIndex(Position, CS);
+    entries.erase(Position);
+}
+
+ProcedurePointsTo *PointsToData::getOrCreateAtFunction(const Function *F) {
     auto P = data.find(F);
-    ProcedurePointsTo *Pointsto;
-    if (P == data.end()) {
-        Pointsto = new ProcedurePointsTo();
-        data.insert(std::make_pair(F, Pointsto));
-    }
-    else
-        Pointsto = P->second;
-
-    for (auto I = Pointsto->begin(), E = Pointsto->end(); I != E; ++I) {
-        CallString ICS = std::get<0>(*I);
-        if (ICS.isCyclic() && ICS.matches(CS)) {
-            // We need to remove the call string completely here because it may
-            // have been made cyclic prematurely. It is possible to break here
-            // because the removal of call strings in
-            // attemptMakeCyclicCallString ensures that others do not match.
-            Pointsto->erase(I);
-            break;
-        }
-        if (CS == ICS) {
-            auto IData = std::get<1>(*I);
-            PointsToRelation IPT = std::get<2>(*I);
-            LivenessSet IL = std::get<3>(*I);
-            if (IPT == EntryPT && IL == ExitL) {
-                Changed = false;
-                return IData;
+    if (P != data.end())
+        return P->second;
+
+    ProcedurePointsTo *Pointsto = new (procedureAllocator.Allocate()) ProcedurePointsTo();
+    data.insert(std::make_pair(F, Pointsto));
+    return Pointsto;
+}
+
+void PointsToData::merge(const PointsToData &Other, DenseMap<const IntraproceduralPointsTo *, IntraproceduralPointsTo *> &Copies) {
+    // The facts are shared between instructions and contexts, so each one is
+    // only interned here once.
+    DenseMap<const LivenessSet *, const LivenessSet *> sets;
+    DenseMap<const PointsToRelation *, const PointsToRelation *> relations;
+    auto internSet = [&](const LivenessSet *L) -> const LivenessSet * {
+        const LivenessSet *&Copy = sets[L];
+        if (Copy == nullptr)
+            Copy = intern(*L);
+        return Copy;
+    };
+    auto internRelation = [&](const PointsToRelation *R) -> const PointsToRelation * {
+        const PointsToRelation *&Copy = relations[R];
+        if (Copy == nullptr)
+            Copy = intern(*R);
+        return Copy;
+    };
+
+    for (auto &P : Other.data) {
+        ProcedurePointsTo *Pointsto = getOrCreateAtFunction(P.first);
+        for (const ProcedurePointsTo::Entry &E : *P.second) {
+            assert(Pointsto->find(std::get<0>(E)) == nullptr && "The call strings of the two must not overlap.");
+            IntraproceduralPointsTo *&Out = Copies[std::get<1>(E)];
+            if (Out == nullptr) {
+                Out = new (mapAllocator.Allocate()) IntraproceduralPointsTo();
+                for (auto &I : *std::get<1>(E))
+                    Out->insert({I.first, {internSet(I.second.first), internRelation(I.second.second)}});
             }
-            else {
-                *I = std::make_tuple(ICS, IData, IPT, IL);
-                Changed = true;
-                return IData;
+            Pointsto->insert(std::make_tuple(std::get<0>(E), Out, internRelation(std::get<2>(E)), internSet(std::get<3>(E))));
+        }
+    }
+}
+
+void PointsToData::eraseFunction(const Function *F) {
+    data.erase(F);
+}
+
+bool PointsToData::shouldSweep() const {
+    // The facts are swept once they have doubled since the last sweep, so
+    // the cost of sweeping is proportional to the number of facts interned.
+    unsigned Size = livenessSets.size() + relations.size();
+    unsigned Kept = livenessSets.sizeAfterSweep() + relations.sizeAfterSweep();
+    return Size >= 4096 && Size >= 2 * Kept;
+}
+
+void PointsToData::sweep(DenseSet<const LivenessSet *> &Sets, DenseSet<const PointsToRelation *> &Relations) {
+    for (auto &P : data) {
+        for (const ProcedurePointsTo::Entry &E : *P.second) {
+            for (auto &I : *std::get<1>(E)) {
+                Sets.insert(I.second.first);
+                Relations.insert(I.second.second);
             }
+            Relations.insert(std::get<2>(E));
+            Sets.insert(std::get<3>(E));
         }
     }
+    livenessSets.sweep(Sets);
+    relations.sweep(Relations);
+}
+
+IntraproceduralPointsTo *PointsToData::getPointsTo(const CallString &CS, const Function *F, const PointsToRelation &EntryPT, const LivenessSet &ExitL, bool BlockBoundariesOnly, bool &Changed) {
+    assert (!CS.isCyclic() && "Information has already been computed.");
+
+    ProcedurePointsTo *Pointsto = getOrCreateAtFunction(F);
+    const PointsToRelation *InternedPT = intern(EntryPT);
+    const LivenessSet *InternedL = intern(ExitL);
+
+    if (ProcedurePointsTo::Entry *Cyclic = Pointsto->findCyclicMatch(CS)) {
+        // We need to remove the call string completely here because it may
+        // have been made cyclic prematurely. The removal of call strings in
+        // attemptMakeCyclicCallString ensures that no other call string
+        // matches.
+        Pointsto->erase(std::get<0>(*Cyclic));
+    }
+    else if (ProcedurePointsTo::Entry *Existing = Pointsto->find(CS)) {
+        Changed = std::get<2>(*Existing) != InternedPT || std::get<3>(*Existing) != InternedL;
+        return std::get<1>(*Existing);
+    }
 
     // The call string wasn't found.
-    IntraproceduralPointsTo *Out = new IntraproceduralPointsTo();
+    IntraproceduralPointsTo *Out = new (mapAllocator.Allocate()) IntraproceduralPointsTo();
     for (const_inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
-        Out->insert({&*I, {new LivenessSet(), new PointsToRelation()}});
-    Pointsto->push_back(std::make_tuple(CS, Out, EntryPT, ExitL));
+        if (!BlockBoundariesOnly || isBlockBoundary(&*I))
+            Out->insert({&*I, {getEmptyLivenessSet(), getEmptyRelation()}});
+    Pointsto->insert(std::make_tuple(CS, Out, InternedPT, InternedL));
     Changed = true;
     return Out;
 }
@@ -86,9 +224,6 @@ bool PointsToData::attemptMakeCyclicCallString(const Function *F, const CallStri
     if (CS.isEmpty())
         return false;
 
-    auto LastCall = CS.getLastCall();
-    auto LastCalledFunction = CS.getLastCalledFunction();
-
     auto pair = data.find(F);
     assert(pair != data.end());
 
@@ -97,37 +232,29 @@ bool PointsToData::attemptMakeCyclicCallString(const Function *F, const CallStri
     // CS = S . S' and a points to map which matches Out, then the call
     // string in the pair can be replaced with S . S'*, since adding an
     // extra S' to the end does not change the points to map.
-    auto I = V->begin(), E = V->end();
-    for (; I != E; ++I) {
-        auto ICS = std::get<0>(*I);
-        auto IData = std::get<1>(*I);
-        auto IPT = std::get<2>(*I);
-        auto IL = std::get<3>(*I);
-        if ((ICS.isEmpty() || ICS.getLastCall() == LastCall || (LastCalledFunction != nullptr && ICS.getLastCalledFunction() == LastCalledFunction)) &&
-            CS.isNonCyclicPrefix(ICS) &&
-            arePointsToMapsEqual(F, IData, *Out)) {
+    ProcedurePointsTo::Entry *Found = nullptr;
+    for (ProcedurePointsTo::Entry *E : V->findWithSameLastCall(CS)) {
+        const CallString &ICS = std::get<0>(*E);
+        if (CS.isNonCyclicPrefix(ICS) && arePointsToMapsEqual(F, std::get<1>(*E), *Out)) {
             CallString newCS = CS.createCyclicFromPrefix(ICS);
-            *I = std::make_tuple(newCS, Out, IPT, IL);
+            V->replace(E, std::make_tuple(newCS, Out, std::get<2>(*E), std::get<3>(*E)));
+            Found = E;
             break;
         }
     }
 
-    if (I != E) {
-        auto ICS = std::get<0>(*I);
-        CallString R = ICS;
-        // Remove all call strings that match the inserted one.
-        for (auto I2 = V->begin(); I2 != E; ) {
-            if (I != I2 && !std::get<0>(*I2).isCyclic() && R.matches(std::get<0>(*I2))) {
-                I2 = V->erase(I2);
-                E = V->end();
-            }
-            else
-                ++I2;
-        }
-        return true;
-    }
-    else
+    if (Found == nullptr)
         return false;
+
+    // Remove all call strings that match the inserted one.
+    const CallString &R = std::get<0>(*Found);
+    SmallVector<CallString, 4> matched;
+    for (auto &E : *V)
+        if (&E != Found && !std::get<0>(E).isCyclic() && R.matches(std::get<0>(E)))
+            matched.push_back(std::get<0>(E));
+    for (const CallString &M : matched)
+        V->erase(M);
+    return true;
 }
 
 bool PointsToData::hasDataForFunction(const Function *F) const {
@@ -145,12 +272,8 @@ IntraproceduralPointsTo *PointsToData::get(const Function *F, const CallString &
         return nullptr;
 
     ProcedurePointsTo *V = I->second;
-    for (auto P : *V) {
-        auto PCS = std::get<0>(P);
-        auto PData = std::get<1>(P);
-        if (PCS.matches(CS))
-            return PData;
-    }
-
-    return nullptr;
+    ProcedurePointsTo::Entry *E = V->find(CS);
+    if (E == nullptr)
+        E = V->findCyclicMatch(CS);
+    return E == nullptr ? nullptr : std::get<1>(*E);
 }
@@ -0,0 +1,87 @@
+#include <algorithm>
+
+#include "llvm/IR/InstIterator.h"
+
+#include "PointsToIndex.h"
+#include "PointsToNode.h"
+
+static void sortUnique(SmallVectorImpl<unsigned> &V) {
+    std::sort(V.begin(), V.end());
+    V.erase(std::unique(V.begin(), V.end()), V.end());
+}
+
+void PointsToIndex::build(Module &M, LivenessPointsTo &Analysis) {
+    ids.clear();
+    records.clear();
+
+    SmallVector<PointsToNode *, 4> Nodes;
+    SmallVector<unsigned, 8> Pointees, Ancestors;
+    for (Function &F : M) {
+        if (F.isDeclaration() || !Analysis.hasPointsTo(F))
+            continue;
+
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            if (!I->getType()->isPointerTy())
+                continue;
+
+            Record R;
+            R.AllowMustAlias = true;
+            Analysis.getPointsToSet(&*I, Nodes, R.AllowMustAlias);
+
+            collectIds(Nodes, Pointees, Ancestors);
+
+            R.Offset = ids.size();
+            R.NumPointees = Pointees.size();
+            R.NumAncestors = Ancestors.size();
+            ids.insert(ids.end(), Pointees.begin(), Pointees.end());
+            ids.insert(ids.end(), Ancestors.begin(), Ancestors.end());
+            records.insert(std::make_pair(&*I, R));
+        }
+    }
+
+    ids.shrink_to_fit();
+}
+
+void PointsToIndex::collectIds(ArrayRef<PointsToNode *> Nodes, SmallVectorImpl<unsigned> &Pointees, SmallVectorImpl<unsigned> &Ancestors) {
+    // A node is a sub-node of the nodes on the path to it from the node that
+    // it is a field of.
+    Pointees.clear();
+    Ancestors.clear();
+    for (const PointsToNode *N : Nodes) {
+        Pointees.push_back(N->getId());
+        for (;;) {
+            Ancestors.push_back(N->getId());
+            const GEPPointsToNode *GEP = dyn_cast<GEPPointsToNode>(N);
+            if (GEP == nullptr)
+                break;
+            N = GEP->Parent;
+        }
+    }
+    sortUnique(Pointees);
+    sortUnique(Ancestors);
+}
+
+bool PointsToIndex::lookup(const Value *V, Entry &E) const {
+    auto R = records.find(V);
+    if (R == records.end())
+        return false;
+
+    ArrayRef<unsigned> All(ids);
+    E.Pointees = All.slice(R->second.Offset, R->second.NumPointees);
+    E.Ancestors = All.slice(R->second.Offset + R->second.NumPointees, R->second.NumAncestors);
+    E.AllowMustAlias = R->second.AllowMustAlias;
+    return true;
+}
+
+bool PointsToIndex::intersects(ArrayRef<unsigned> A, ArrayRef<unsigned> B) {
+    auto I = A.begin(), IE = A.end(), J = B.begin(), JE = B.end();
+    while (I != IE && J != JE) {
+        if (*I < *J)
+            ++I;
+        else if (*J < *I)
+            ++J;
+        else
+            return true;
+    }
+    return false;
+}
@@ -1,3 +0,0 @@
-#include "PointsToNode.h"
-
-int PointsToNode::nextId = 0;
@@ -35,7 +35,7 @@ bool PointsToNodeFactory::matchGEPNode(const GEPOperator *I, const PointsToNode
     return false;
 }
 
-PointsToNode *PointsToNodeFactory::getGEPNode(const GEPOperator *I, const Type *Type, PointsToNode *Parent, PointsToNode *Pointee) const {
+PointsToNode *PointsToNodeFactory::getGEPNode(const GEPOperator *I, const Type *Type, PointsToNode *Parent, PointsToNode *Pointee) {
     // We use a special representation of GEPs which can be analysed to
     // implement field-sensitivity. Multiple values can map to the same GEP node
     // (when the GEP has the same pointer operand and indices).  Note that
@@ -47,10 +47,17 @@ PointsToNode *PointsToNodeFactory::getGEPNode(const GEPOperator *I, const Type *
         }
     }
 
-    return new GEPPointsToNode(Parent, Type, I, Pointee);
+    return new (gepNodes.Allocate()) GEPPointsToNode(Parent, Type, I, Pointee);
+}
+
+GEPPointsToNode *PointsToNodeFactory::createGEPNode(PointsToNode *Parent, const Type *Type, const SmallVector<APInt, 8> &Indices, PointsToNode *Pointee) {
+    std::lock_guard<std::recursive_mutex> Guard(lock);
+    // The constructor adds the node to the list of children.
+    return new (gepNodes.Allocate()) GEPPointsToNode(Parent, Type, Indices, Pointee);
 }
 
 PointsToNode* PointsToNodeFactory::getNode(const Value *V) {
+    std::lock_guard<std::recursive_mutex> Guard(lock);
     assert(V != nullptr);
 
     if (isa<UndefValue>(V))
@@ -107,7 +114,7 @@ PointsToNode* PointsToNodeFactory::getNode(const Value *V) {
                 if (CI->paramHasAttr(0, Attribute::NoAlias))
                     Pointee = getNoAliasNode(CI);
             }
-            Node = new ValuePointsToNode(V, Pointee);
+            Node = new (valueNodes.Allocate()) ValuePointsToNode(table, V, Pointee);
         }
 
         map.insert(std::make_pair(V, Node));
@@ -116,39 +123,51 @@ PointsToNode* PointsToNodeFactory::getNode(const Value *V) {
 }
 
 PointsToNode* PointsToNodeFactory::getNoAliasNode(const AllocaInst *I) {
+    std::lock_guard<std::recursive_mutex> Guard(lock);
     auto KV = noAliasMap.find(I);
     if (KV != noAliasMap.end())
         return KV->second;
     else {
-        PointsToNode *Node = new NoAliasPointsToNode(I);
+        PointsToNode *Node = new (noAliasNodes.Allocate()) NoAliasPointsToNode(table, I);
         noAliasMap.insert(std::make_pair(I, Node));
         return Node;
     }
 }
 
 PointsToNode* PointsToNodeFactory::getNoAliasNode(const CallInst *I) {
+    std::lock_guard<std::recursive_mutex> Guard(lock);
     auto KV = noAliasMap.find(I);
     if (KV != noAliasMap.end())
         return KV->second;
     else {
-        PointsToNode *Node = new NoAliasPointsToNode(I);
+        PointsToNode *Node = new (noAliasNodes.Allocate()) NoAliasPointsToNode(table, I);
         noAliasMap.insert(std::make_pair(I, Node));
         return Node;
     }
 }
 
+void PointsToNodeFactory::forget(ArrayRef<const Value *> Values) {
+    std::lock_guard<std::recursive_mutex> Guard(lock);
+    for (const Value *V : Values) {
+        map.erase(V);
+        noAliasMap.erase(V);
+    }
+}
+
 PointsToNode* PointsToNodeFactory::getGlobalNode(const GlobalObject *V) {
+    std::lock_guard<std::recursive_mutex> Guard(lock);
     auto KV = globalMap.find(V);
     if (KV != globalMap.end())
         return KV->second;
     else {
-        PointsToNode *Node = new GlobalPointsToNode(V);
+        PointsToNode *Node = new (globalNodes.Allocate()) GlobalPointsToNode(table, V);
         globalMap.insert(std::make_pair(V, Node));
         return Node;
     }
 }
 
 PointsToNode *PointsToNodeFactory::getIndexedNode(PointsToNode *A, const GEPOperator *GEP) {
+    std::lock_guard<std::recursive_mutex> Guard(lock);
     assert(GEP->hasAllConstantIndices());
     assert(!A->singlePointee() && "getIndexedNode cannot be used on nodes with a constant pointee.");
     assert(GEP->getType()->isPointerTy());
@@ -157,5 +176,5 @@ PointsToNode *PointsToNodeFactory::getIndexedNode(PointsToNode *A, const GEPOper
             return Child;
 
     // We create a new GEP node which has A as its parent.
-    return new GEPPointsToNode(A, GEP->getType()->getPointerElementType(), GEP->idx_begin(), GEP->idx_end(), nullptr);
+    return new (gepNodes.Allocate()) GEPPointsToNode(A, GEP->getType()->getPointerElementType(), GEP->idx_begin(), GEP->idx_end(), nullptr);
 }
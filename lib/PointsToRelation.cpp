@@ -1,10 +1,23 @@
+#include <algorithm>
+
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "PointsToRelation.h"
 
+const PointsToRelation::PointeeSet PointsToRelation::emptyPointees;
+
 void PointsToRelation::dump() const {
+    // The index isn't ordered, so sort the pairs to keep the output stable.
+    SmallVector<std::pair<PointsToNode *, PointsToNode *>, 16> pairs(begin(), end());
+    std::sort(pairs.begin(), pairs.end(), [](const std::pair<PointsToNode *, PointsToNode *> &A, const std::pair<PointsToNode *, PointsToNode *> &B) {
+        if (A.first->getId() != B.first->getId())
+            return A.first->getId() < B.first->getId();
+        return A.second->getId() < B.second->getId();
+    });
+
     bool first = true;
-    for (auto P : s) {
+    for (auto P : pairs) {
         if (!first)
             errs() << ", ";
         first = false;
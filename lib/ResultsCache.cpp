@@ -0,0 +1,529 @@
+#include <algorithm>
+#include <cstring>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "PointsToNode.h"
+#include "ResultsCache.h"
+
+// The layout of a cache. All integers are little-endian.
+//
+// The header is the magic string, the hash of the module, the version, the
+// number of sections, and then the offset and number of records of each
+// section, as 64-bit integers. The sections follow the header. The paths of
+// the nodes are 64-bit integers, and the records of the other sections are
+// made of 32-bit integers:
+//
+// Nodes:         kind, base A, base B, path offset, path length, last length
+// Functions:     first value, number of arguments, number of instructions
+// Values:        pointees offset, number of pointees, flags
+// Pointees:      node
+// Sets:          elements offset, number of elements
+// SetElements:   node
+// Relations:     pairs offset, number of pairs
+// RelationPairs: pointer node, pointee node
+// Contexts:      function, facts offset
+// Facts:         liveness set before, relation after
+//
+// There is a value for each argument and instruction of each function, and a
+// fact for each instruction of the context's function.
+static const char Magic[8] = {'L', 'F', 'C', 'P', 'A', 'R', 'C', '\0'};
+static const uint32_t Version = 2;
+static const unsigned HeaderSize = 32 + ResultsCache::NumSections * 16;
+static const unsigned Widths[ResultsCache::NumSections] = {2, 6, 3, 3, 1, 2, 1, 2, 2, 2, 2};
+
+enum ValueFlags {
+    VF_Known = 1,
+    VF_NoMustAlias = 2
+};
+
+bool ModuleHash::operator==(const ModuleHash &H) const {
+    return std::equal(Bytes, Bytes + 16, H.Bytes);
+}
+
+ModuleHash hashModule(const Module &M) {
+    std::string Text;
+    raw_string_ostream OS(Text);
+    M.print(OS, nullptr);
+    OS.flush();
+
+    MD5 Hash;
+    Hash.update(Text);
+    MD5::MD5Result Result;
+    Hash.final(Result);
+    ModuleHash H;
+    std::copy(Result, Result + 16, H.Bytes);
+    return H;
+}
+
+std::pair<CachedNode::Base, SmallVector<uint64_t, 4>> CachedNode::getAddress() const {
+    unsigned parentLength = Path.size() - Last;
+    SmallVector<uint64_t, 4> parentPath(Path.begin(), Path.begin() + parentLength);
+    SmallVector<uint64_t, 4> indices(Path.begin() + parentLength, Path.end());
+    while (!indices.empty() && indices.back() == 0)
+        indices.pop_back();
+    return std::make_pair(std::make_tuple(K, A, B, parentPath), indices);
+}
+
+bool CachedNode::isSubNodeOf(const CachedNode &N) const {
+    return K == N.K && A == N.A && B == N.B && N.Path.size() <= Path.size() && std::equal(N.Path.begin(), N.Path.end(), Path.begin());
+}
+
+const unsigned ModuleNumbering::None;
+
+ModuleNumbering::ModuleNumbering(const Module &M) {
+    unsigned globals = 0;
+    for (const GlobalVariable &G : M.globals())
+        globalNumbers.insert(std::make_pair(&G, globals++));
+    for (const Function &F : M) {
+        functionNumbers.insert(std::make_pair(&F, functions.size()));
+        functions.push_back(&F);
+        globalNumbers.insert(std::make_pair(&F, globals++));
+    }
+    // The values are numbered while the module is the one that the cache was
+    // written for, since passes that run later may add or remove some.
+    for (const Function &F : M) {
+        std::vector<const Value *> &Values = values[&F];
+        for (const Argument &A : F.args()) {
+            valueNumbers.insert(std::make_pair(&A, Values.size()));
+            Values.push_back(&A);
+        }
+        for (const BasicBlock &BB : F) {
+            for (const Instruction &I : BB) {
+                valueNumbers.insert(std::make_pair(&I, Values.size()));
+                Values.push_back(&I);
+            }
+        }
+    }
+}
+
+unsigned ModuleNumbering::getFunction(const Function *F) const {
+    auto N = functionNumbers.find(F);
+    return N == functionNumbers.end() ? None : N->second;
+}
+
+const Function *ModuleNumbering::getFunction(unsigned N) const {
+    return N < functions.size() ? functions[N] : nullptr;
+}
+
+unsigned ModuleNumbering::getGlobal(const GlobalObject *G) const {
+    auto N = globalNumbers.find(G);
+    return N == globalNumbers.end() ? None : N->second;
+}
+
+unsigned ModuleNumbering::getValue(const Value *V) const {
+    auto N = valueNumbers.find(V);
+    return N == valueNumbers.end() ? None : N->second;
+}
+
+void ModuleNumbering::forget(const Value *V) {
+    auto N = valueNumbers.find(V);
+    if (N == valueNumbers.end())
+        return;
+    const Function *F = isa<Argument>(V) ? cast<Argument>(V)->getParent() : cast<Instruction>(V)->getParent()->getParent();
+    values[F][N->second] = nullptr;
+    valueNumbers.erase(N);
+}
+
+const Value *ModuleNumbering::getValue(const Function *F, unsigned N) const {
+    auto Values = values.find(F);
+    return Values != values.end() && N < Values->second.size() ? Values->second[N] : nullptr;
+}
+
+unsigned ModuleNumbering::getNumValues(const Function *F) const {
+    auto Values = values.find(F);
+    return Values == values.end() ? 0 : Values->second.size();
+}
+
+namespace {
+// Collects the records of each section, so that the offsets of the sections
+// are known before the file is written.
+class CacheWriter {
+    public:
+        CacheWriter(const Module &M, LivenessPointsTo &Analysis) : numbering(M), analysis(Analysis) {}
+        void addFunction(Function &F);
+        void addContexts(Function &F);
+        bool write(StringRef Path, const ModuleHash &Hash);
+    private:
+        unsigned getNode(const PointsToNode *N);
+        unsigned getSet(const LivenessSet *L);
+        unsigned getRelation(const PointsToRelation *R);
+        void add(ResultsCache::Section S, ArrayRef<uint32_t> Record) {
+            assert(Record.size() == Widths[S]);
+            records[S].append(Record.begin(), Record.end());
+        }
+        unsigned size(ResultsCache::Section S) const {
+            return records[S].size() / Widths[S];
+        }
+
+        ModuleNumbering numbering;
+        LivenessPointsTo &analysis;
+        std::vector<uint64_t> paths;
+        SmallVector<uint32_t, 64> records[ResultsCache::NumSections];
+        DenseMap<const PointsToNode *, unsigned> nodes;
+        DenseMap<const LivenessSet *, unsigned> sets;
+        DenseMap<const PointsToRelation *, unsigned> relations;
+};
+}
+
+unsigned CacheWriter::getNode(const PointsToNode *N) {
+    auto Existing = nodes.find(N);
+    if (Existing != nodes.end())
+        return Existing->second;
+
+    unsigned kind = CachedNode::CNK_Other, a = size(ResultsCache::S_Nodes), b = 0;
+    SmallVector<uint64_t, 8> path;
+    unsigned last = 0;
+    if (const GEPPointsToNode *G = dyn_cast<GEPPointsToNode>(N)) {
+        unsigned parent = getNode(G->Parent);
+        const uint32_t *P = &records[ResultsCache::S_Nodes][parent * Widths[ResultsCache::S_Nodes]];
+        kind = P[0];
+        a = P[1];
+        b = P[2];
+        path.append(paths.begin() + P[3], paths.begin() + P[3] + P[4]);
+        for (const APInt &I : G->indices)
+            path.push_back(I.getZExtValue());
+        last = G->indices.size();
+    }
+    else if (isa<UnknownPointsToNode>(N))
+        kind = CachedNode::CNK_Unknown;
+    else if (isa<InitPointsToNode>(N))
+        kind = CachedNode::CNK_Init;
+    else if (const GlobalPointsToNode *G = dyn_cast<GlobalPointsToNode>(N)) {
+        kind = CachedNode::CNK_Global;
+        a = 0;
+        b = numbering.getGlobal(G->getObject());
+    }
+    else if (const NoAliasPointsToNode *NA = dyn_cast<NoAliasPointsToNode>(N)) {
+        kind = CachedNode::CNK_NoAlias;
+        a = numbering.getFunction(NA->Site->getParent()->getParent());
+        b = numbering.getValue(NA->Site);
+    }
+    else if (const ValuePointsToNode *V = dyn_cast<ValuePointsToNode>(N)) {
+        if (const GlobalObject *G = dyn_cast<GlobalObject>(V->Val)) {
+            kind = CachedNode::CNK_Value;
+            a = ModuleNumbering::None;
+            b = numbering.getGlobal(G);
+        }
+        else if (isa<Argument>(V->Val) || isa<Instruction>(V->Val)) {
+            const Function *F = isa<Argument>(V->Val) ? cast<Argument>(V->Val)->getParent() : cast<Instruction>(V->Val)->getParent()->getParent();
+            kind = CachedNode::CNK_Value;
+            a = numbering.getFunction(F);
+            b = numbering.getValue(V->Val);
+        }
+    }
+
+    unsigned Index = size(ResultsCache::S_Nodes);
+    add(ResultsCache::S_Nodes, {kind, a, b, (uint32_t)paths.size(), (uint32_t)path.size(), last});
+    paths.insert(paths.end(), path.begin(), path.end());
+    nodes.insert(std::make_pair(N, Index));
+    return Index;
+}
+
+unsigned CacheWriter::getSet(const LivenessSet *L) {
+    auto Existing = sets.find(L);
+    if (Existing != sets.end())
+        return Existing->second;
+
+    SmallVector<uint32_t, 16> elements;
+    for (PointsToNode *N : *L)
+        elements.push_back(getNode(N));
+    unsigned Index = size(ResultsCache::S_Sets);
+    add(ResultsCache::S_Sets, {(uint32_t)size(ResultsCache::S_SetElements), (uint32_t)elements.size()});
+    records[ResultsCache::S_SetElements].append(elements.begin(), elements.end());
+    sets.insert(std::make_pair(L, Index));
+    return Index;
+}
+
+unsigned CacheWriter::getRelation(const PointsToRelation *R) {
+    auto Existing = relations.find(R);
+    if (Existing != relations.end())
+        return Existing->second;
+
+    SmallVector<uint32_t, 32> pairs;
+    for (auto &P : *R) {
+        pairs.push_back(getNode(P.first));
+        pairs.push_back(getNode(P.second));
+    }
+    unsigned Index = size(ResultsCache::S_Relations);
+    add(ResultsCache::S_Relations, {(uint32_t)size(ResultsCache::S_RelationPairs), (uint32_t)pairs.size() / 2});
+    records[ResultsCache::S_RelationPairs].append(pairs.begin(), pairs.end());
+    relations.insert(std::make_pair(R, Index));
+    return Index;
+}
+
+void CacheWriter::addFunction(Function &F) {
+    unsigned numArguments = F.arg_size();
+    unsigned numValues = numbering.getNumValues(&F);
+    add(ResultsCache::S_Functions, {(uint32_t)size(ResultsCache::S_Values), numArguments, numValues - numArguments});
+
+    bool analysed = analysis.hasPointsTo(F);
+    for (unsigned i = 0; i < numValues; i++) {
+        const Value *V = numbering.getValue(&F, i);
+        if (!analysed || !isa<Instruction>(V) || !V->getType()->isPointerTy()) {
+            add(ResultsCache::S_Values, {0, 0, 0});
+            continue;
+        }
+
+        bool allowMustAlias = true;
+        SmallVector<PointsToNode *, 4> pointees;
+        analysis.getPointsToSet(V, pointees, allowMustAlias);
+        uint32_t flags = pointees.empty() ? 0 : VF_Known;
+        if (!allowMustAlias)
+            flags |= VF_NoMustAlias;
+        add(ResultsCache::S_Values, {(uint32_t)size(ResultsCache::S_Pointees), (uint32_t)pointees.size(), flags});
+        for (PointsToNode *N : pointees)
+            records[ResultsCache::S_Pointees].push_back(getNode(N));
+    }
+}
+
+void CacheWriter::addContexts(Function &F) {
+    if (!analysis.hasPointsTo(F))
+        return;
+
+    analysis.materialize(F);
+    unsigned function = numbering.getFunction(&F);
+    for (const ProcedurePointsTo::Entry &E : *analysis.getPointsTo(F)) {
+        add(ResultsCache::S_Contexts, {function, (uint32_t)size(ResultsCache::S_Facts)});
+        const IntraproceduralPointsTo *Result = std::get<1>(E);
+        for (const BasicBlock &BB : F) {
+            for (const Instruction &I : BB) {
+                auto Facts = Result->find(&I);
+                if (Facts == Result->end())
+                    add(ResultsCache::S_Facts, {ModuleNumbering::None, ModuleNumbering::None});
+                else
+                    add(ResultsCache::S_Facts, {getSet(Facts->second.first), getRelation(Facts->second.second)});
+            }
+        }
+    }
+}
+
+bool CacheWriter::write(StringRef Path, const ModuleHash &Hash) {
+    // The cache is written to a temporary file and then moved into place, so
+    // that a reader never sees a partly written cache. The name of the file
+    // is unique, so that writers of the same cache don't share it.
+    SmallString<128> Temporary;
+    int FD;
+    if (sys::fs::createUniqueFile(Path + ".tmp-%%%%%%%%", FD, Temporary))
+        return false;
+    {
+        raw_fd_ostream OS(FD, /*shouldClose=*/true);
+
+        support::endian::Writer<support::little> W(OS);
+        OS.write(Magic, sizeof(Magic));
+        OS.write(reinterpret_cast<const char *>(Hash.Bytes), sizeof(Hash.Bytes));
+        W.write<uint32_t>(Version);
+        W.write<uint32_t>(ResultsCache::NumSections);
+        uint64_t offset = HeaderSize;
+        for (unsigned S = 0; S < ResultsCache::NumSections; S++) {
+            uint64_t count = S == ResultsCache::S_Paths ? paths.size() : size((ResultsCache::Section)S);
+            W.write<uint64_t>(offset);
+            W.write<uint64_t>(count);
+            offset += count * Widths[S] * 4;
+        }
+
+        for (uint64_t P : paths)
+            W.write<uint64_t>(P);
+        for (unsigned S = 0; S < ResultsCache::NumSections; S++)
+            for (uint32_t V : records[S])
+                W.write<uint32_t>(V);
+
+        OS.close();
+        if (OS.has_error()) {
+            OS.clear_error();
+            sys::fs::remove(Temporary);
+            return false;
+        }
+    }
+
+    if (sys::fs::rename(Temporary, Path)) {
+        sys::fs::remove(Temporary);
+        return false;
+    }
+    return true;
+}
+
+bool writeResultsCache(StringRef Path, Module &M, const ModuleHash &Hash, LivenessPointsTo &Analysis) {
+    CacheWriter Writer(M, Analysis);
+    for (Function &F : M)
+        Writer.addFunction(F);
+    for (Function &F : M)
+        Writer.addContexts(F);
+    return Writer.write(Path, Hash);
+}
+
+ResultsCache::ResultsCache(std::unique_ptr<MemoryBuffer> Buffer, const Module &M) : buffer(std::move(Buffer)), numbering(M) {
+    const char *Start = buffer->getBufferStart();
+    uint64_t Size = buffer->getBufferSize();
+    for (unsigned S = 0; S < NumSections; S++) {
+        const char *Entry = Start + 32 + S * 16;
+        uint64_t Offset = support::endian::read<uint64_t, support::little, support::unaligned>(Entry);
+        uint64_t Count = support::endian::read<uint64_t, support::little, support::unaligned>(Entry + 8);
+        uint64_t RecordSize = Widths[S] * 4;
+        if (Offset < HeaderSize || Offset > Size || Count > (Size - Offset) / RecordSize) {
+            sections[S] = nullptr;
+            counts[S] = 0;
+        }
+        else {
+            sections[S] = Start + Offset;
+            counts[S] = Count;
+        }
+    }
+}
+
+std::unique_ptr<ResultsCache> ResultsCache::open(StringRef Path, const Module &M, const ModuleHash &Hash) {
+    auto Buffer = MemoryBuffer::getFile(Path, -1, false);
+    if (!Buffer)
+        return nullptr;
+
+    StringRef Data = (*Buffer)->getBuffer();
+    if (Data.size() < HeaderSize || std::memcmp(Data.data(), Magic, sizeof(Magic)) != 0 || std::memcmp(Data.data() + 8, Hash.Bytes, sizeof(Hash.Bytes)) != 0)
+        return nullptr;
+    if (support::endian::read<uint32_t, support::little, support::unaligned>(Data.data() + 24) != Version || support::endian::read<uint32_t, support::little, support::unaligned>(Data.data() + 28) != NumSections)
+        return nullptr;
+
+    std::unique_ptr<ResultsCache> Cache(new ResultsCache(std::move(*Buffer), M));
+    if (!Cache->isValid())
+        return nullptr;
+    return Cache;
+}
+
+bool ResultsCache::isValid() const {
+    for (unsigned S = 0; S < NumSections; S++)
+        if (sections[S] == nullptr)
+            return false;
+    return counts[S_Functions] == numbering.getNumFunctions();
+}
+
+const support::ulittle32_t *ResultsCache::getRecord(Section S, unsigned I) const {
+    assert(S != S_Paths);
+    if (I >= counts[S])
+        return nullptr;
+    return reinterpret_cast<const support::ulittle32_t *>(sections[S]) + (uint64_t)I * Widths[S];
+}
+
+bool ResultsCache::readNode(unsigned I, CachedNode &N) const {
+    const support::ulittle32_t *R = getRecord(S_Nodes, I);
+    if (R == nullptr || R[3] > counts[S_Paths] || R[4] > counts[S_Paths] - R[3] || R[5] > R[4])
+        return false;
+
+    N.K = R[0];
+    N.A = R[1];
+    N.B = R[2];
+    N.Last = R[5];
+    N.Path.clear();
+    const support::ulittle64_t *Path = reinterpret_cast<const support::ulittle64_t *>(sections[S_Paths]) + R[3];
+    for (unsigned i = 0; i < R[4]; i++)
+        N.Path.push_back(Path[i]);
+    return true;
+}
+
+void ResultsCache::getPointsToSet(const Value *V, SmallVectorImpl<CachedNode> &Result, bool &AllowMustAlias) {
+    Result.clear();
+    CachedNode N;
+    N.Last = 0;
+    if (const Instruction *I = dyn_cast<Instruction>(V)) {
+        // Values created after the cache was opened aren't in it.
+        unsigned Number = numbering.getValue(I);
+        const support::ulittle32_t *F = getRecord(S_Functions, numbering.getFunction(I->getParent()->getParent()));
+        if (F == nullptr || Number == ModuleNumbering::None)
+            return;
+        const support::ulittle32_t *R = getRecord(S_Values, F[0] + Number);
+        if (R == nullptr || !(R[2] & VF_Known))
+            return;
+        if (R[2] & VF_NoMustAlias)
+            AllowMustAlias = false;
+        for (unsigned i = 0; i < R[1]; i++) {
+            const support::ulittle32_t *P = getRecord(S_Pointees, R[0] + i);
+            if (P == nullptr || !readNode(*P, N)) {
+                Result.clear();
+                return;
+            }
+            Result.push_back(N);
+        }
+    }
+    else if (const GlobalVariable *G = dyn_cast<GlobalVariable>(V)) {
+        N.K = CachedNode::CNK_Global;
+        N.A = 0;
+        N.B = numbering.getGlobal(G);
+        Result.push_back(N);
+    }
+    else if (const GEPOperator *GEP = dyn_cast<GEPOperator>(V)) {
+        if (GEP->hasAllConstantIndices()) {
+            if (const GlobalVariable *Base = dyn_cast<GlobalVariable>(GEP->getPointerOperand())) {
+                N.K = CachedNode::CNK_Global;
+                N.A = 0;
+                N.B = numbering.getGlobal(Base);
+                for (auto I = GEP->idx_begin(), E = GEP->idx_end(); I != E; ++I)
+                    N.Path.push_back(cast<ConstantInt>(I)->getZExtValue());
+                N.Last = N.Path.size();
+                Result.push_back(N);
+            }
+        }
+        else if (const GlobalObject *Base = dyn_cast<GlobalObject>(GEP->getPointerOperand())) {
+            // As in the analysis, the node of the pointer operand stands for
+            // the result.
+            N.K = CachedNode::CNK_Value;
+            N.A = ModuleNumbering::None;
+            N.B = numbering.getGlobal(Base);
+            AllowMustAlias = false;
+            Result.push_back(N);
+        }
+    }
+}
+
+void ResultsCache::deleteValue(const Value *V) {
+    numbering.forget(V);
+}
+
+unsigned ResultsCache::getNumContexts() const {
+    return counts[S_Contexts];
+}
+
+const Function *ResultsCache::getContextFunction(unsigned C) const {
+    const support::ulittle32_t *R = getRecord(S_Contexts, C);
+    return R == nullptr ? nullptr : numbering.getFunction(R[0]);
+}
+
+bool ResultsCache::getFactsAt(unsigned C, const Instruction *I, SmallVectorImpl<CachedNode> &Lin, SmallVectorImpl<std::pair<CachedNode, CachedNode>> &Aout) {
+    Lin.clear();
+    Aout.clear();
+    unsigned Number = numbering.getValue(I);
+    const support::ulittle32_t *R = getRecord(S_Contexts, C);
+    if (R == nullptr || Number == ModuleNumbering::None || numbering.getFunction(R[0]) != I->getParent()->getParent())
+        return false;
+
+    const support::ulittle32_t *Facts = getRecord(S_Facts, R[1] + Number - I->getParent()->getParent()->arg_size());
+    const support::ulittle32_t *S = Facts == nullptr ? nullptr : getRecord(S_Sets, Facts[0]);
+    const support::ulittle32_t *T = Facts == nullptr ? nullptr : getRecord(S_Relations, Facts[1]);
+    if (S == nullptr || T == nullptr)
+        return false;
+
+    // Part of the facts would be unsound, so any record that can't be read
+    // makes them unknown.
+    CachedNode N, M;
+    for (unsigned i = 0; i < S[1]; i++) {
+        const support::ulittle32_t *E = getRecord(S_SetElements, S[0] + i);
+        if (E == nullptr || !readNode(*E, N)) {
+            Lin.clear();
+            return false;
+        }
+        Lin.push_back(N);
+    }
+    for (unsigned i = 0; i < T[1]; i++) {
+        const support::ulittle32_t *P = getRecord(S_RelationPairs, T[0] + i);
+        if (P == nullptr || !readNode(P[0], N) || !readNode(P[1], M)) {
+            Lin.clear();
+            Aout.clear();
+            return false;
+        }
+        Aout.push_back(std::make_pair(N, M));
+    }
+    return true;
+}